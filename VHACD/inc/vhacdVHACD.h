@@ -26,10 +26,18 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 
 #include "vhacdMutex.h"
 #include "vhacdVolume.h"
+#include <string>
+#include <vector>
 
 #define USE_THREAD 1
+#if USE_THREAD == 1 && _OPENMP >= 201511 // OpenMP 4.5: task and taskloop
+#define USE_TASKS 1
+#else
+#define USE_TASKS 0
+#endif
 #define OCL_MIN_NUM_PRIMITIVES 4096
 #define CH_APP_MIN_NUM_PRIMITIVES 64000
+#define SVT_MAX_NUM_CELLS (1 << 25)
 namespace VHACD {
 class VHACD : public IVHACD {
 public:
@@ -69,6 +77,10 @@ public:
         ch.m_points = mesh->GetPoints();
         ch.m_triangles = mesh->GetTriangles();
     }
+    void GetStats(Stats& stats) const
+    {
+        stats = m_stats;
+    }
     void Clean(void)
     {
         delete m_volume;
@@ -98,6 +110,7 @@ public:
         const unsigned int strideTriangles,
         const unsigned int nTriangles,
         const Parameters& params);
+    bool Compute(const InputMesh& mesh, const Parameters& params);
     bool OCLInit(void* const oclDevice,
         IUserLogger* const logger = 0);
     bool OCLRelease(IUserLogger* const logger = 0);
@@ -147,8 +160,60 @@ private:
         m_rot[0][0] = m_rot[1][1] = m_rot[2][2] = 1.0;
         SetCancel(false);
     }
+    void AddConvexHullStats(const size_t nConvexHulls, const size_t nPoints)
+    {
+#if USE_THREAD == 1 && _OPENMP
+#pragma omp atomic
+#endif
+        m_stats.m_nConvexHullComputations += (unsigned int)nConvexHulls;
+#if USE_THREAD == 1 && _OPENMP
+#pragma omp atomic
+#endif
+        m_stats.m_nConvexHullPoints += nPoints;
+    }
+    //! Dimension, at least minDim, at which the mesh gives about params.m_resolution voxels, predicted from its volume
+    //! at another dimension and from the reference length of its bounding box once aligned.
+    size_t PredictDim(const Volume& volume, const double referenceLength, const size_t minDim, const Parameters& params) const;
     void ComputePrimitiveSet(const Parameters& params);
     void ComputeACD(const Parameters& params);
+    bool SubdividePart(PrimitiveSet* const pset,
+        const bool firstPart,
+        const char* const partName,
+        const double progress0,
+        const double progress1,
+        const double progress2,
+        PrimitiveSet*& bestLeft,
+        PrimitiveSet*& bestRight,
+        double& minConcavity,
+        const Parameters& params);
+    void SubdivideLevels(PrimitiveSet* const root,
+        SArray<PrimitiveSet*>& parts,
+        const Parameters& params);
+#if USE_TASKS == 1
+    struct PartRecord {
+        PrimitiveSet* m_pset;
+        int m_level;
+        std::string m_path;
+        bool operator<(const PartRecord& rhs) const
+        {
+            return (m_level != rhs.m_level) ? m_level < rhs.m_level : m_path < rhs.m_path;
+        }
+    };
+    //! Parts of a subdivision level: created by the splits of the previous level, and done once split or final.
+    struct LevelProgress {
+        size_t m_nParts;
+        size_t m_nDoneParts;
+        double m_maxConcavity;
+    };
+    void SubdividePartTask(PrimitiveSet* const pset,
+        const int sub,
+        const std::string& path,
+        std::vector<PartRecord>& parts,
+        const Parameters& params);
+    //! Counts the part of level sub as done, and reports the progress of the subdivision as the level loop does:
+    //! per done part, and from the concavity of the splits once a level is complete.
+    void FinishPartTask(const int sub, const bool split, const double minConcavity, const Parameters& params);
+#endif //USE_TASKS == 1
     void MergeConvexHulls(const Parameters& params);
     void SimplifyConvexHulls(const Parameters& params);
     void ComputeBestClippingPlane(const PrimitiveSet* inputPSet,
@@ -163,12 +228,14 @@ private:
         const double progress1,
         Plane& bestPlane,
         double& minConcavity,
+        Mesh* const bestLeftCH,
+        Mesh* const bestRightCH,
         const Parameters& params);
-    template <class T>
+    template <class T, class I>
     void AlignMesh(const T* const points,
         const unsigned int stridePoints,
         const unsigned int nPoints,
-        const int* const triangles,
+        const I* const triangles,
         const unsigned int strideTriangles,
         const unsigned int nTriangles,
         const Parameters& params)
@@ -191,12 +258,15 @@ private:
         if (GetCancel()) {
             return;
         }
+        // The coarse grid is kept for VoxelizeMesh to predict its resolution from.
+        delete m_volume;
         m_dim = (size_t)(pow((double)params.m_resolution, 1.0 / 3.0) + 0.5);
-        Volume volume;
-        volume.Voxelize(points, stridePoints, nPoints,
+        m_volume = new Volume;
+        m_volume->Voxelize(points, stridePoints, nPoints,
             triangles, strideTriangles, nTriangles,
             m_dim, m_barycenter, m_rot);
-        size_t n = volume.GetNPrimitivesOnSurf() + volume.GetNPrimitivesInsideSurf();
+        ++m_stats.m_nVoxelizations;
+        size_t n = m_volume->GetNPrimitivesOnSurf() + m_volume->GetNPrimitivesInsideSurf();
         Update(50.0, 100.0, params);
 
         if (params.m_logger) {
@@ -209,22 +279,48 @@ private:
         }
         m_operation = "PCA";
         Update(50.0, 0.0, params);
-        volume.AlignToPrincipalAxes(m_rot);
+        m_volume->AlignToPrincipalAxes(m_rot);
         m_overallProgress = 1.0;
         Update(100.0, 100.0, params);
 
         m_timer.Toc();
+        m_stats.m_alignMeshTime = m_timer.GetElapsedTime();
         if (params.m_logger) {
             msg.str("");
             msg << "\t time " << m_timer.GetElapsedTime() / 1000.0 << "s" << std::endl;
             params.m_logger->Log(msg.str().c_str());
         }
     }
-    template <class T>
+    template <class T, class I>
+    void RevoxelizeMesh(const T* const points,
+        const unsigned int stridePoints,
+        const unsigned int nPoints,
+        const I* const triangles,
+        const unsigned int strideTriangles,
+        const unsigned int nTriangles,
+        const size_t dim,
+        const Parameters& params)
+    {
+        m_operation = "Voxelization";
+        Update(50.0, 0.0, params);
+        delete m_volume;
+        m_dim = dim;
+        m_volume = new Volume;
+        m_volume->Voxelize(points, stridePoints, nPoints,
+            triangles, strideTriangles, nTriangles,
+            m_dim, m_barycenter, m_rot);
+        ++m_stats.m_nVoxelizations;
+        if (params.m_logger) {
+            std::ostringstream msg;
+            msg << "\t dim = " << m_dim << "\t-> " << m_volume->GetNPrimitivesOnSurf() + m_volume->GetNPrimitivesInsideSurf() << " voxels" << std::endl;
+            params.m_logger->Log(msg.str().c_str());
+        }
+    }
+    template <class T, class I>
     void VoxelizeMesh(const T* const points,
         const unsigned int stridePoints,
         const unsigned int nPoints,
-        const int* const triangles,
+        const I* const triangles,
         const unsigned int strideTriangles,
         const unsigned int nTriangles,
         const Parameters& params)
@@ -242,64 +338,76 @@ private:
             params.m_logger->Log(msg.str().c_str());
         }
 
-        delete m_volume;
-        m_volume = 0;
-        int iteration = 0;
-        const int maxIteration = 5;
-        double progress = 0.0;
-        while (iteration++ < maxIteration && !m_cancel) {
-            msg.str("");
-            msg << "Iteration " << iteration;
-            m_operation = msg.str();
-
-            progress = iteration * 100.0 / maxIteration;
-            Update(progress, 0.0, params);
-
+        // A first voxelization at m_dim, the one of AlignMesh if any, predicts the dimension giving
+        // params.m_resolution voxels; the mesh is then voxelized once more at that dimension if it differs.
+        const bool sameFrame = (m_volume == 0);
+        if (sameFrame) {
+            m_operation = "Coarse voxelization";
+            Update(0.0, 0.0, params);
             m_volume = new Volume;
             m_volume->Voxelize(points, stridePoints, nPoints,
                 triangles, strideTriangles, nTriangles,
                 m_dim, m_barycenter, m_rot);
-
-            Update(progress, 100.0, params);
-
-            size_t n = m_volume->GetNPrimitivesOnSurf() + m_volume->GetNPrimitivesInsideSurf();
+            ++m_stats.m_nVoxelizations;
             if (params.m_logger) {
                 msg.str("");
-                msg << "\t dim = " << m_dim << "\t-> " << n << " voxels" << std::endl;
+                msg << "\t dim = " << m_dim << "\t-> " << m_volume->GetNPrimitivesOnSurf() + m_volume->GetNPrimitivesInsideSurf() << " voxels" << std::endl;
                 params.m_logger->Log(msg.str().c_str());
             }
-
-            double a = pow((double)(params.m_resolution) / n, 0.33);
-            size_t dim_next = (size_t)(m_dim * a + 0.5);
-            if (n < params.m_resolution && iteration < maxIteration && m_volume->GetNPrimitivesOnSurf() < params.m_resolution / 8 && m_dim != dim_next) {
-                delete m_volume;
-                m_volume = 0;
-                m_dim = dim_next;
-            }
-            else {
-                break;
+        }
+        const double referenceLength = Volume::ComputeReferenceLength(points, stridePoints, nPoints, m_barycenter, m_rot);
+        const size_t coarseDim = m_dim;
+        size_t dim = m_dim;
+        // As in the refinement loop, a coarse grid which already has params.m_resolution voxels, or
+        // params.m_resolution / 8 voxels on its surface, is not refined.
+        if (m_volume->GetNPrimitivesOnSurf() + m_volume->GetNPrimitivesInsideSurf() < params.m_resolution
+            && m_volume->GetNPrimitivesOnSurf() < params.m_resolution / 8) {
+            dim = PredictDim(*m_volume, referenceLength, m_dim, params);
+        }
+        // The coarse grid of AlignMesh was computed before the mesh was rotated.
+        if (!m_cancel && (dim != m_dim || !sameFrame)) {
+            RevoxelizeMesh(points, stridePoints, nPoints, triangles, strideTriangles, nTriangles, dim, params);
+            // Thin parts of the mesh lie on the surface of the coarse grid, but fill in at the predicted
+            // dimension: while the grid has more than params.m_resolution voxels, the dimension is predicted
+            // again from it.
+            while (!m_cancel && m_dim > coarseDim
+                && m_volume->GetNPrimitivesOnSurf() + m_volume->GetNPrimitivesInsideSurf() > params.m_resolution) {
+                dim = PredictDim(*m_volume, referenceLength, coarseDim, params);
+                if (dim >= m_dim) {
+                    dim = m_dim - 1;
+                }
+                RevoxelizeMesh(points, stridePoints, nPoints, triangles, strideTriangles, nTriangles, dim, params);
             }
         }
         m_overallProgress = 10.0;
         Update(100.0, 100.0, params);
 
         m_timer.Toc();
+        m_stats.m_voxelizationTime = m_timer.GetElapsedTime();
+        if (m_volume) {
+            m_stats.m_dim = (unsigned int)m_dim;
+            m_stats.m_nVoxelsOnSurface = (unsigned int)m_volume->GetNPrimitivesOnSurf();
+            m_stats.m_nVoxelsInsideSurface = (unsigned int)m_volume->GetNPrimitivesInsideSurf();
+        }
         if (params.m_logger) {
             msg.str("");
             msg << "\t time " << m_timer.GetElapsedTime() / 1000.0 << "s" << std::endl;
             params.m_logger->Log(msg.str().c_str());
         }
     }
-    template <class T>
+    template <class T, class I>
     bool ComputeACD(const T* const points,
         const unsigned int stridePoints,
         const unsigned int nPoints,
-        const int* const triangles,
+        const I* const triangles,
         const unsigned int strideTriangles,
         const unsigned int nTriangles,
         const Parameters& params)
     {
         Init();
+        m_stats.Init();
+        Timer timer;
+        timer.Tic();
         if (params.m_oclAcceleration) {
             // build kernals
         }
@@ -312,6 +420,8 @@ private:
         if (params.m_oclAcceleration) {
             // Release kernals
         }
+        timer.Toc();
+        m_stats.m_totalTime = timer.GetElapsedTime();
         if (GetCancel()) {
             Clean();
             return false;
@@ -333,9 +443,16 @@ private:
     size_t m_dim;
     Volume* m_volume;
     PrimitiveSet* m_pset;
+    Stats m_stats;
     Mutex m_cancelMutex;
     bool m_cancel;
     int m_ompNumProcessors;
+#if USE_TASKS == 1
+    std::vector<LevelProgress> m_levels;
+    size_t m_nCompleteLevels;
+    size_t m_nParts;
+    size_t m_nDoneParts;
+#endif //USE_TASKS == 1
 #ifdef CL_VERSION_1_1
     cl_device_id* m_oclDevice;
     cl_context m_oclContext;
@@ -18,6 +18,13 @@
 #include "vhacdMesh.h"
 #include "vhacdVector.h"
 #include <assert.h>
+#include <limits.h>
+#include <memory>
+#include <stdint.h>
+#include <string.h>
+#if _OPENMP
+#include <omp.h>
+#endif // _OPENMP
 
 #ifdef _MSC_VER
 #pragma warning(push)
@@ -57,35 +64,169 @@ public:
         SArray<Vec3<double> >* const exteriorPts) const = 0;
     virtual void ComputeClippedVolumes(const Plane& plane, double& positiveVolume,
         double& negativeVolume) const = 0;
+    virtual void ComputeClippedVolumes(const SArray<Plane>& planes, SArray<double>& positiveVolumes,
+        SArray<double>& negativeVolumes) const = 0;
     virtual void SelectOnSurface(PrimitiveSet* const onSurfP) const = 0;
-    virtual void ComputeConvexHull(Mesh& meshCH, const size_t sampling = 1) const = 0;
+    //! Returns the number of points fed to the convex-hull computer.
+    virtual size_t ComputeConvexHull(Mesh& meshCH, const size_t sampling = 1) const = 0;
     virtual void ComputeBB() = 0;
     virtual void ComputePrincipalAxes() = 0;
     virtual void AlignToPrincipalAxes() = 0;
     virtual void RevertAlignToPrincipalAxes() = 0;
     virtual void Convert(Mesh& mesh, const VOXEL_VALUE value) const = 0;
+    //! Convex-hull of the set, carried from the subdivision that created it. Empty until computed.
     const Mesh& GetConvexHull() const { return m_convexHull; };
     Mesh& GetConvexHull() { return m_convexHull; };
 private:
     Mesh m_convexHull;
 };
 
-//!
+//! Voxels of a volume, shared by the VoxelSet built from it and by all the parts clipped from that set.
+//! Voxels are sorted by (i, j, k), the order in which Volume::Convert emits them.
+class VoxelGrid {
+public:
+    //! Voxels of the column (i, j), sorted by k.
+    const Voxel* GetColumnBegin(const short i, const short j) const { return m_voxels.Data() + m_columns[GetColumn(i, j)]; }
+    const Voxel* GetColumnEnd(const short i, const short j) const { return m_voxels.Data() + m_columns[GetColumn(i, j) + 1]; }
+    //! Voxels of the column (i, j) which are on the surface of the grid, sorted by k.
+    const Voxel* GetSurfaceColumnBegin(const short i, const short j) const { return m_surfaceVoxels.Data() + m_surfaceColumns[GetColumn(i, j)]; }
+    const Voxel* GetSurfaceColumnEnd(const short i, const short j) const { return m_surfaceVoxels.Data() + m_surfaceColumns[GetColumn(i, j) + 1]; }
+    const Vec3<short>& GetDim() const { return m_dim; }
+    //! Whether the columns are stored in the Z-order (Morton order) of (i, j) rather than row by row: runs of consecutive
+    //! voxels then cover compact tiles of the grid.
+    bool IsMortonOrdered() const { return m_mortonOrder; }
+    //! Morton code of the column (i, j): the bits of i and j interleaved, those of i on the odd bits.
+    static size_t GetMortonCode(const short i, const short j) { return (SpreadBits((unsigned short)i) << 1) | SpreadBits((unsigned short)j); }
+    //! Rank of the column (i, j) in storage order.
+    size_t GetColumn(const short i, const short j) const { return m_mortonOrder ? GetMortonCode(i, j) : i * m_dim[1] + j; }
+    //! Number of voxels, and of voxels on the surface, in the box [minVoxel, maxVoxel]. O(1), only available
+    //! if the summed-volume tables were built.
+    bool HasSummedVolumeTables() const { return m_solidTable.Size() != 0; }
+    size_t CountVoxels(const Vec3<short>& minVoxel, const Vec3<short>& maxVoxel) const
+    {
+        return SumBox(m_solidTable, minVoxel, maxVoxel);
+    }
+    size_t CountVoxelsOnSurface(const Vec3<short>& minVoxel, const Vec3<short>& maxVoxel) const
+    {
+        return SumBox(m_surfaceTable, minVoxel, maxVoxel);
+    }
+
+private:
+    friend class Volume;
+    size_t SumBox(const SArray<unsigned int>& table, const Vec3<short>& minVoxel, const Vec3<short>& maxVoxel) const;
+    static size_t SpreadBits(size_t x)
+    {
+        x = (x | (x << 8)) & 0x00FF00FF;
+        x = (x | (x << 4)) & 0x0F0F0F0F;
+        x = (x | (x << 2)) & 0x33333333;
+        x = (x | (x << 1)) & 0x55555555;
+        return x;
+    }
+
+    SArray<Voxel, 8> m_voxels;
+    SArray<size_t> m_columns; // m_columns[GetColumn(i, j)]: first voxel of the column (i, j)
+    SArray<Voxel, 8> m_surfaceVoxels;
+    SArray<size_t> m_surfaceColumns;
+    Vec3<short> m_dim;
+    bool m_mortonOrder;
+    // Summed-volume tables: entry (i * (m_dim[1] + 1) + j) * (m_dim[2] + 1) + k holds the number of voxels
+    // (on surface voxels for m_surfaceTable) with coordinates lower than (i, j, k).
+    SArray<unsigned int> m_solidTable;
+    SArray<unsigned int> m_surfaceTable;
+};
+
+//! Coordinates of voxels, one array per axis.
+struct VoxelCoordinates {
+    size_t Size() const { return m_coord[0].Size(); }
+    SArray<short> m_coord[3];
+};
+
+//! Number, bounds and first and second moments of the coordinates of voxels, exact.
+struct VoxelMoments {
+    VoxelMoments() { Reset(); }
+    void Reset()
+    {
+        m_nVoxels = m_nVoxelsOnSurface = 0;
+        m_min[0] = m_min[1] = m_min[2] = SHRT_MAX;
+        m_max[0] = m_max[1] = m_max[2] = SHRT_MIN;
+        memset(m_sum, 0, sizeof(m_sum));
+        memset(m_sum2, 0, sizeof(m_sum2));
+    }
+    void Add(const Voxel& voxel, const bool onSurface)
+    {
+        const int64_t x = voxel.m_coord[0];
+        const int64_t y = voxel.m_coord[1];
+        const int64_t z = voxel.m_coord[2];
+        ++m_nVoxels;
+        m_nVoxelsOnSurface += onSurface;
+        for (int h = 0; h < 3; ++h) {
+            if (m_min[h] > voxel.m_coord[h])
+                m_min[h] = voxel.m_coord[h];
+            if (m_max[h] < voxel.m_coord[h])
+                m_max[h] = voxel.m_coord[h];
+        }
+        m_sum[0] += x;
+        m_sum[1] += y;
+        m_sum[2] += z;
+        m_sum2[0] += x * x;
+        m_sum2[1] += y * y;
+        m_sum2[2] += z * z;
+        m_sum2[3] += x * y;
+        m_sum2[4] += x * z;
+        m_sum2[5] += y * z;
+    }
+    size_t m_nVoxels;
+    size_t m_nVoxelsOnSurface;
+    short m_min[3];
+    short m_max[3];
+    int64_t m_sum[3]; // x, y, z
+    int64_t m_sum2[6]; // xx, yy, zz, xy, xz, yz
+};
+
+//! Set of voxels: the voxels of a shared VoxelGrid lying in an axis-aligned box window.
+//! Clipping a set by one of the axis-aligned planes of ComputeAxesAlignedClippingPlanes only splits its window,
+//! the voxels are never copied.
 class VoxelSet : public PrimitiveSet {
     friend class Volume;
 
 public:
+    //! Visits the voxels of a set in storage order, with m_data set to PRIMITIVE_ON_SURFACE for the voxels
+    //! which are on the surface of the set. With surfaceOnly, only visits these voxels: the columns inside
+    //! the window are then read from the surface voxels of the grid.
+    class Iterator {
+    public:
+        Iterator(const VoxelSet& vset, const bool surfaceOnly = false);
+        inline bool Next(Voxel& voxel);
+
+    private:
+        bool NextColumn();
+        bool NextMortonColumn();
+
+        const VoxelSet& m_vset;
+        const bool m_surfaceOnly;
+        const Voxel* m_voxel;
+        const Voxel* m_columnEnd;
+        const Voxel* m_first; // voxels on the clipped faces along k, outside of [m_voxel, m_columnEnd)
+        const Voxel* m_last;
+        short m_kLast;
+        short m_i;
+        short m_j;
+        size_t m_code; // Morton code of the column (m_i, m_j), for the grids in Morton order
+        size_t m_maxCode;
+        bool m_columnOnSurface;
+    };
+
     //! Destructor.
     ~VoxelSet(void);
     //! Constructor.
     VoxelSet();
 
-    const size_t GetNPrimitives() const { return m_voxels.Size(); }
-    const size_t GetNPrimitivesOnSurf() const { return m_numVoxelsOnSurface; }
-    const size_t GetNPrimitivesInsideSurf() const { return m_numVoxelsInsideSurface; }
+    const size_t GetNPrimitives() const { Count(); return m_numVoxelsOnSurface + m_numVoxelsInsideSurface; }
+    const size_t GetNPrimitivesOnSurf() const { Count(); return m_numVoxelsOnSurface; }
+    const size_t GetNPrimitivesInsideSurf() const { Count(); return m_numVoxelsInsideSurface; }
     const double GetEigenValue(AXIS axis) const { return m_D[axis][axis]; }
-    const double ComputeVolume() const { return m_unitVolume * m_voxels.Size(); }
-    const double ComputeMaxVolumeError() const { return m_unitVolume * m_numVoxelsOnSurface; }
+    const double ComputeVolume() const { return m_unitVolume * GetNPrimitives(); }
+    const double ComputeMaxVolumeError() const { return m_unitVolume * GetNPrimitivesOnSurf(); }
     const Vec3<short>& GetMinBBVoxels() const { return m_minBBVoxels; }
     const Vec3<short>& GetMaxBBVoxels() const { return m_maxBBVoxels; }
     const Vec3<double>& GetMinBB() const { return m_minBB; }
@@ -110,13 +251,18 @@ public:
             voxel[2] * m_scale + m_minBB[2]);
     }
     void GetPoints(const Voxel& voxel, Vec3<double>* const pts) const;
-    void ComputeConvexHull(Mesh& meshCH, const size_t sampling = 1) const;
+    size_t ComputeConvexHull(Mesh& meshCH, const size_t sampling = 1) const;
+    //! plane must be one of the axis-aligned planes of ComputeAxesAlignedClippingPlanes. If the moments of the
+    //! set are known (ComputeBB), the moments of the parts are accumulated in one pass over the voxels of the set,
+    //! and ComputeBB and ComputePrincipalAxes then no longer visit the voxels of the parts.
     void Clip(const Plane& plane, PrimitiveSet* const positivePart, PrimitiveSet* const negativePart) const;
     void Intersect(const Plane& plane, SArray<Vec3<double> >* const positivePts,
         SArray<Vec3<double> >* const negativePts, const size_t sampling) const;
     void ComputeExteriorPoints(const Plane& plane, const Mesh& mesh,
         SArray<Vec3<double> >* const exteriorPts) const;
     void ComputeClippedVolumes(const Plane& plane, double& positiveVolume, double& negativeVolume) const;
+    void ComputeClippedVolumes(const SArray<Plane>& planes, SArray<double>& positiveVolumes,
+        SArray<double>& negativeVolumes) const;
     void SelectOnSurface(PrimitiveSet* const onSurfP) const;
     void ComputeBB();
     void Convert(Mesh& mesh, const VOXEL_VALUE value) const;
@@ -127,15 +273,41 @@ public:
     }
     void AlignToPrincipalAxes(){};
     void RevertAlignToPrincipalAxes(){};
-    Voxel* const GetVoxels() { return m_voxels.Data(); }
-    const Voxel* const GetVoxels() const { return m_voxels.Data(); }
+    //! Copies the voxels of the set, in storage order.
+    void GetVoxels(SArray<Voxel, 8>& voxels) const;
+    //! Copies the coordinates of the surface voxels of the set, in storage order, into one array per axis. The
+    //! surface-only sets selected from the set share them, and Intersect then classifies them against axis-aligned
+    //! planes by blocks, without walking the grid. Clip keeps them up to date for the parts of the set.
+    void ComputeSurfaceCoordinates();
+    bool HasSurfaceCoordinates() const { return m_surfaceCoordinates.get() != 0; }
 
 private:
-    size_t m_numVoxelsOnSurface;
-    size_t m_numVoxelsInsideSurface;
+    //! The voxel layer on the min (bit 2 * axis) or max (bit 2 * axis + 1) face of the window is on the
+    //! surface of the set: the set was clipped there.
+    bool IsFaceOnSurface(const int axis, const int side) const { return (m_surfaceFaces >> (2 * axis + side)) & 1; }
+    void Count() const
+    {
+        if (!m_counted) {
+            CountVoxels();
+        }
+    }
+    void CountVoxels() const;
+    void ComputeMoments();
+    void ClipSurfaceCoordinates(VoxelSet& part, const int axis, const int side, const bool newFace) const;
+
+    std::shared_ptr<const VoxelGrid> m_grid;
+    Vec3<short> m_minWindow; // window of the grid, inclusive
+    Vec3<short> m_maxWindow;
+    unsigned char m_surfaceFaces;
+    bool m_surfaceOnly; // only the voxels on the surface belong to the set
+    mutable bool m_counted;
+    mutable size_t m_numVoxelsOnSurface;
+    mutable size_t m_numVoxelsInsideSurface;
+    std::shared_ptr<const VoxelCoordinates> m_surfaceCoordinates;
+    VoxelMoments m_moments;
+    bool m_hasMoments;
     Vec3<double> m_minBB;
     double m_scale;
-    SArray<Voxel, 8> m_voxels;
     double m_unitVolume;
     Vec3<double> m_minBBPts;
     Vec3<double> m_maxBBPts;
@@ -147,6 +319,43 @@ private:
     Vec3<double> m_barycenterPCA;
 };
 
+inline bool VoxelSet::Iterator::Next(Voxel& voxel)
+{
+    for (;;) {
+        if (m_first) {
+            voxel = *m_first;
+            voxel.m_data = PRIMITIVE_ON_SURFACE;
+            m_first = 0;
+            return true;
+        }
+        while (m_voxel < m_columnEnd) {
+            voxel = *m_voxel++;
+            if (voxel.m_coord[2] > m_kLast) {
+                m_voxel = m_columnEnd;
+                break;
+            }
+            if (voxel.m_data != PRIMITIVE_ON_SURFACE
+                && (m_columnOnSurface
+                       || (voxel.m_coord[2] == m_vset.m_minWindow[2] && m_vset.IsFaceOnSurface(2, 0))
+                       || (voxel.m_coord[2] == m_vset.m_maxWindow[2] && m_vset.IsFaceOnSurface(2, 1)))) {
+                voxel.m_data = PRIMITIVE_ON_SURFACE;
+            }
+            if (voxel.m_data == PRIMITIVE_ON_SURFACE || !m_surfaceOnly) {
+                return true;
+            }
+        }
+        if (m_last) {
+            voxel = *m_last;
+            voxel.m_data = PRIMITIVE_ON_SURFACE;
+            m_last = 0;
+            return true;
+        }
+        if (!NextColumn()) {
+            return false;
+        }
+    }
+}
+
 struct Tetrahedron {
 public:
     Vec3<double> m_pts[4];
@@ -173,7 +382,7 @@ public:
     const double GetSacle() const { return m_scale; }
     const double ComputeVolume() const;
     const double ComputeMaxVolumeError() const;
-    void ComputeConvexHull(Mesh& meshCH, const size_t sampling = 1) const;
+    size_t ComputeConvexHull(Mesh& meshCH, const size_t sampling = 1) const;
     void ComputePrincipalAxes();
     void AlignToPrincipalAxes();
     void RevertAlignToPrincipalAxes();
@@ -183,6 +392,8 @@ public:
     void ComputeExteriorPoints(const Plane& plane, const Mesh& mesh,
         SArray<Vec3<double> >* const exteriorPts) const;
     void ComputeClippedVolumes(const Plane& plane, double& positiveVolume, double& negativeVolume) const;
+    void ComputeClippedVolumes(const SArray<Plane>& planes, SArray<double>& positiveVolumes,
+        SArray<double>& negativeVolumes) const;
     void SelectOnSurface(PrimitiveSet* const onSurfP) const;
     void ComputeBB();
     void Convert(Mesh& mesh, const VOXEL_VALUE value) const;
@@ -217,40 +428,95 @@ public:
     Volume();
 
     //! Voxelize
-    template <class T>
+    template <class T, class I>
     void Voxelize(const T* const points, const unsigned int stridePoints, const unsigned int nPoints,
-        const int* const triangles, const unsigned int strideTriangles, const unsigned int nTriangles,
+        const I* const triangles, const unsigned int strideTriangles, const unsigned int nTriangles,
         const size_t dim, const Vec3<double>& barycenter, const double (&rot)[3][3]);
-    unsigned char& GetVoxel(const size_t i, const size_t j, const size_t k)
+    //! Length of the side of the aligned mesh bounding box that Voxelize divides into dim - 1 voxels.
+    template <class T>
+    static double ComputeReferenceLength(const T* const points, const unsigned int stridePoints, const unsigned int nPoints,
+        const Vec3<double>& barycenter, const double (&rot)[3][3]);
+    unsigned char GetVoxel(const size_t i, const size_t j, const size_t k) const
     {
-        assert(i < m_dim[0] || i >= 0);
-        assert(j < m_dim[0] || j >= 0);
-        assert(k < m_dim[0] || k >= 0);
-        return m_data[i + j * m_dim[0] + k * m_dim[0] * m_dim[1]];
+        assert(i < m_dim[0] && j < m_dim[1] && k < m_dim[2]);
+        const size_t brick = GetBrick(i, j, k);
+        if (!m_bricks[brick]) {
+            return m_brickValues[brick];
+        }
+        return (unsigned char)((m_bricks[brick][GetBrickWord(i, j)] >> GetBrickShift(j, k)) & 3);
     }
-    const unsigned char& GetVoxel(const size_t i, const size_t j, const size_t k) const
+    void SetVoxel(const size_t i, const size_t j, const size_t k, const unsigned char value)
     {
-        assert(i < m_dim[0] || i >= 0);
-        assert(j < m_dim[0] || j >= 0);
-        assert(k < m_dim[0] || k >= 0);
-        return m_data[i + j * m_dim[0] + k * m_dim[0] * m_dim[1]];
+        assert(i < m_dim[0] && j < m_dim[1] && k < m_dim[2]);
+        const size_t brick = GetBrick(i, j, k);
+        if (!m_bricks[brick]) {
+            if (m_brickValues[brick] == value) {
+                return;
+            }
+            MaterializeBrick(brick);
+        }
+        uint64_t& word = m_bricks[brick][GetBrickWord(i, j)];
+        const int shift = GetBrickShift(j, k);
+        word = (word & ~((uint64_t)3 << shift)) | ((uint64_t)value << shift);
     }
     const size_t GetNPrimitivesOnSurf() const { return m_numVoxelsOnSurface; }
     const size_t GetNPrimitivesInsideSurf() const { return m_numVoxelsInsideSurface; }
+    const double GetScale() const { return m_scale; }
     void Convert(Mesh& mesh, const VOXEL_VALUE value) const;
-    void Convert(VoxelSet& vset) const;
+    //! Also builds the summed-volume tables of the voxel grid if they have at most maxSummedVolumeTableCells cells.
+    //! With mortonOrder, the columns of the grid are stored in Morton order (see VoxelGrid::IsMortonOrdered).
+    void Convert(VoxelSet& vset, const size_t maxSummedVolumeTableCells = 0, const bool mortonOrder = false) const;
     void Convert(TetrahedronSet& tset) const;
     void AlignToPrincipalAxes(double (&rot)[3][3]) const;
 
 private:
-    void FillOutsideSurface(const size_t i0, const size_t j0, const size_t k0, const size_t i1,
-        const size_t j1, const size_t k1);
+    void FillOutsideSurface();
+    void PushOutsideSeeds(const short i, const short j, const short k0, const short k1, SArray<Vec3<short> >& seeds) const;
     void FillInsideSurface();
     template <class T>
-    void ComputeBB(const T* const points, const unsigned int stridePoints, const unsigned int nPoints,
-        const Vec3<double>& barycenter, const double (&rot)[3][3]);
+    static void ComputeBB(const T* const points, const unsigned int stridePoints, const unsigned int nPoints,
+        const Vec3<double>& barycenter, const double (&rot)[3][3], Vec3<double>& minBB, Vec3<double>& maxBB);
+    //! The longest side of the bounding box, or z on ties.
+    static int GetReferenceAxis(const double (&d)[3])
+    {
+        if (d[0] > d[1] && d[0] > d[2]) {
+            return 0;
+        }
+        if (d[1] > d[0] && d[1] > d[2]) {
+            return 1;
+        }
+        return 2;
+    }
+    //! coords holds the grid coordinates of the nPoints points: all the x, then all the y, then all the z.
+    void ComputeTriangleBB(const double* const coords, const size_t nPoints, const size_t (&triangle)[3], Vec3<double> (&p)[3],
+        size_t& i0, size_t& j0, size_t& k0, size_t& i1, size_t& j1, size_t& k1) const;
+    size_t RasterizeTriangle(const Vec3<double> (&p)[3], const size_t i0, const size_t j0, const size_t k0,
+        const size_t i1, const size_t j1, const size_t k1);
     void Allocate();
     void Free();
+    //! The grid is made of bricks of BRICK_SIZE^3 voxels. A brick is either uniform, all its voxels having the
+    //! value m_brickValues[brick] and no storage, or materialized in BRICK_WORDS words with 2 bits per voxel:
+    //! word (i % 8) * 2 + (j % 8) / 4 packs the rows along k of four consecutive j. The voxels of a brick lying
+    //! beyond the grid hold PRIMITIVE_OUTSIDE_SURFACE.
+    size_t GetBrick(const size_t i, const size_t j, const size_t k) const
+    {
+        return ((i / BRICK_SIZE) * m_brickDim[1] + j / BRICK_SIZE) * m_brickDim[2] + k / BRICK_SIZE;
+    }
+    static size_t GetBrickWord(const size_t i, const size_t j) { return (i % BRICK_SIZE) * 2 + (j % BRICK_SIZE) / 4; }
+    static int GetBrickShift(const size_t j, const size_t k) { return (int)(2 * ((j % 4) * BRICK_SIZE + k % BRICK_SIZE)); }
+    //! 2-bit voxels (i, j, k) of the brick for its BRICK_SIZE values of k.
+    unsigned int GetBrickRow(const size_t i, const size_t j, const size_t brick) const
+    {
+        const uint64_t* const data = m_bricks[brick];
+        return data ? (unsigned int)(data[GetBrickWord(i, j)] >> GetBrickShift(j, 0)) & 0xFFFF : 0x5555u * m_brickValues[brick];
+    }
+    void MaterializeBrick(const size_t brick);
+    //! Number of voxels of the brick lying in the grid.
+    size_t GetBrickNumVoxels(const size_t brick) const;
+    void GetBrickOrigin(const size_t brick, size_t& i, size_t& j, size_t& k) const;
+
+    static const size_t BRICK_SIZE = 8;
+    static const size_t BRICK_WORDS = 16;
 
     Vec3<double> m_minBB;
     Vec3<double> m_maxBB;
@@ -259,7 +525,10 @@ private:
     size_t m_numVoxelsOnSurface;
     size_t m_numVoxelsInsideSurface;
     size_t m_numVoxelsOutsideSurface;
-    unsigned char* m_data;
+    size_t m_brickDim[3];
+    size_t m_numBricks;
+    uint64_t** m_bricks;
+    unsigned char* m_brickValues;
 };
 int TriBoxOverlap(const Vec3<double>& boxcenter, const Vec3<double>& boxhalfsize, const Vec3<double>& triver0,
     const Vec3<double>& triver1, const Vec3<double>& triver2);
@@ -288,136 +557,144 @@ inline void ComputeAlignedPoint<double>(const double* const points, const unsign
 }
 template <class T>
 void Volume::ComputeBB(const T* const points, const unsigned int stridePoints, const unsigned int nPoints,
-    const Vec3<double>& barycenter, const double (&rot)[3][3])
+    const Vec3<double>& barycenter, const double (&rot)[3][3], Vec3<double>& minBB, Vec3<double>& maxBB)
 {
     Vec3<double> pt;
     ComputeAlignedPoint(points, 0, barycenter, rot, pt);
-    m_maxBB = pt;
-    m_minBB = pt;
+    maxBB = pt;
+    minBB = pt;
     for (unsigned int v = 1; v < nPoints; ++v) {
         ComputeAlignedPoint(points, v * stridePoints, barycenter, rot, pt);
         for (int i = 0; i < 3; ++i) {
-            if (pt[i] < m_minBB[i])
-                m_minBB[i] = pt[i];
-            else if (pt[i] > m_maxBB[i])
-                m_maxBB[i] = pt[i];
+            if (pt[i] < minBB[i])
+                minBB[i] = pt[i];
+            else if (pt[i] > maxBB[i])
+                maxBB[i] = pt[i];
         }
     }
 }
 template <class T>
+double Volume::ComputeReferenceLength(const T* const points, const unsigned int stridePoints, const unsigned int nPoints,
+    const Vec3<double>& barycenter, const double (&rot)[3][3])
+{
+    if (nPoints == 0) {
+        return 0.0;
+    }
+    Vec3<double> minBB;
+    Vec3<double> maxBB;
+    ComputeBB(points, stridePoints, nPoints, barycenter, rot, minBB, maxBB);
+    const double d[3] = { maxBB[0] - minBB[0], maxBB[1] - minBB[1], maxBB[2] - minBB[2] };
+    return d[GetReferenceAxis(d)];
+}
+template <class T, class I>
 void Volume::Voxelize(const T* const points, const unsigned int stridePoints, const unsigned int nPoints,
-    const int* const triangles, const unsigned int strideTriangles, const unsigned int nTriangles,
+    const I* const triangles, const unsigned int strideTriangles, const unsigned int nTriangles,
     const size_t dim, const Vec3<double>& barycenter, const double (&rot)[3][3])
 {
     if (nPoints == 0) {
         return;
     }
-    ComputeBB(points, stridePoints, nPoints, barycenter, rot);
-
-    double d[3] = { m_maxBB[0] - m_minBB[0], m_maxBB[1] - m_minBB[1], m_maxBB[2] - m_minBB[2] };
-    double r;
-    if (d[0] > d[1] && d[0] > d[2]) {
-        r = d[0];
-        m_dim[0] = dim;
-        m_dim[1] = 2 + static_cast<size_t>(dim * d[1] / d[0]);
-        m_dim[2] = 2 + static_cast<size_t>(dim * d[2] / d[0]);
+    // Transform the points once; the triangle loops below read their grid coordinates, x, y and z arrays in a row.
+    SArray<double> coords;
+    coords.Resize(3 * (size_t)nPoints);
+    double* const x = coords.Data();
+    double* const y = x + nPoints;
+    double* const z = y + nPoints;
+#if _OPENMP
+#pragma omp parallel for
+#endif
+    for (int v = 0; v < (int)nPoints; ++v) {
+        Vec3<double> pt;
+        ComputeAlignedPoint(points, v * stridePoints, barycenter, rot, pt);
+        x[v] = pt[0];
+        y[v] = pt[1];
+        z[v] = pt[2];
     }
-    else if (d[1] > d[0] && d[1] > d[2]) {
-        r = d[1];
-        m_dim[1] = dim;
-        m_dim[0] = 2 + static_cast<size_t>(dim * d[0] / d[1]);
-        m_dim[2] = 2 + static_cast<size_t>(dim * d[2] / d[1]);
+    m_minBB = Vec3<double>(x[0], y[0], z[0]);
+    m_maxBB = m_minBB;
+    for (unsigned int v = 1; v < nPoints; ++v) {
+        const Vec3<double> pt(x[v], y[v], z[v]);
+        for (int i = 0; i < 3; ++i) {
+            if (pt[i] < m_minBB[i])
+                m_minBB[i] = pt[i];
+            else if (pt[i] > m_maxBB[i])
+                m_maxBB[i] = pt[i];
+        }
     }
-    else {
-        r = d[2];
-        m_dim[2] = dim;
-        m_dim[0] = 2 + static_cast<size_t>(dim * d[0] / d[2]);
-        m_dim[1] = 2 + static_cast<size_t>(dim * d[1] / d[2]);
+
+    const double d[3] = { m_maxBB[0] - m_minBB[0], m_maxBB[1] - m_minBB[1], m_maxBB[2] - m_minBB[2] };
+    const int axis = GetReferenceAxis(d);
+    const double r = d[axis];
+    for (int h = 0; h < 3; ++h) {
+        m_dim[h] = (h == axis) ? dim : 2 + static_cast<size_t>(dim * d[h] / r);
     }
 
     m_scale = r / (dim - 1);
     double invScale = (dim - 1) / r;
+#if _OPENMP
+#pragma omp parallel for
+#endif
+    for (int v = 0; v < (int)nPoints; ++v) {
+        x[v] = (x[v] - m_minBB[0]) * invScale;
+        y[v] = (y[v] - m_minBB[1]) * invScale;
+        z[v] = (z[v] - m_minBB[2]) * invScale;
+    }
 
     Allocate();
     m_numVoxelsOnSurface = 0;
     m_numVoxelsInsideSurface = 0;
     m_numVoxelsOutsideSurface = 0;
 
-    Vec3<double> p[3];
-    size_t i, j, k;
-    size_t i0, j0, k0;
-    size_t i1, j1, k1;
-    Vec3<double> boxcenter;
-    Vec3<double> pt;
-    const Vec3<double> boxhalfsize(0.5, 0.5, 0.5);
-    for (size_t t = 0, ti = 0; t < nTriangles; ++t, ti += strideTriangles) {
-        Vec3<int> tri(triangles[ti + 0],
-            triangles[ti + 1],
-            triangles[ti + 2]);
-        for (int c = 0; c < 3; ++c) {
-            ComputeAlignedPoint(points, tri[c] * stridePoints, barycenter, rot, pt);
-            p[c][0] = (pt[0] - m_minBB[0]) * invScale;
-            p[c][1] = (pt[1] - m_minBB[1]) * invScale;
-            p[c][2] = (pt[2] - m_minBB[2]) * invScale;
-            i = static_cast<size_t>(p[c][0] + 0.5);
-            j = static_cast<size_t>(p[c][1] + 0.5);
-            k = static_cast<size_t>(p[c][2] + 0.5);
-            assert(i < m_dim[0] && i >= 0 && j < m_dim[1] && j >= 0 && k < m_dim[2] && k >= 0);
-
-            if (c == 0) {
-                i0 = i1 = i;
-                j0 = j1 = j;
-                k0 = k1 = k;
-            }
-            else {
-                if (i < i0)
-                    i0 = i;
-                if (j < j0)
-                    j0 = j;
-                if (k < k0)
-                    k0 = k;
-                if (i > i1)
-                    i1 = i;
-                if (j > j1)
-                    j1 = j;
-                if (k > k1)
-                    k1 = k;
+    // Bin the triangles into z-slabs. Each slab is rasterized by a single thread, so no two threads
+    // ever write the same voxel and the grid does not depend on the scheduling.
+#if _OPENMP
+    const size_t nThreads = (size_t)omp_get_max_threads();
+#else
+    const size_t nThreads = 1;
+#endif
+    // Slabs start on a brick boundary: a brick is only materialized and written by the thread of its slab.
+    const size_t nSlabsMax = (nThreads > 1) ? 4 * nThreads : 1;
+    const size_t slabSize = ((m_dim[2] + nSlabsMax - 1) / nSlabsMax + BRICK_SIZE - 1) / BRICK_SIZE * BRICK_SIZE;
+    const size_t nSlabs = (m_dim[2] + slabSize - 1) / slabSize;
+    SArray<unsigned int>* slabTriangles = 0;
+    if (nSlabs > 1) {
+        slabTriangles = new SArray<unsigned int>[nSlabs];
+        Vec3<double> p[3];
+        size_t i0, j0, k0;
+        size_t i1, j1, k1;
+        for (unsigned int t = 0; t < nTriangles; ++t) {
+            const I* const corners = triangles + (size_t)t * strideTriangles;
+            const size_t triangle[3] = { (size_t)corners[0], (size_t)corners[1], (size_t)corners[2] };
+            ComputeTriangleBB(x, nPoints, triangle, p, i0, j0, k0, i1, j1, k1);
+            for (size_t s = k0 / slabSize; s <= (k1 - 1) / slabSize; ++s) {
+                slabTriangles[s].PushBack(t);
             }
         }
-        if (i0 > 0)
-            --i0;
-        if (j0 > 0)
-            --j0;
-        if (k0 > 0)
-            --k0;
-        if (i1 < m_dim[0])
-            ++i1;
-        if (j1 < m_dim[1])
-            ++j1;
-        if (k1 < m_dim[2])
-            ++k1;
-        for (size_t i = i0; i < i1; ++i) {
-            boxcenter[0] = (double)i;
-            for (size_t j = j0; j < j1; ++j) {
-                boxcenter[1] = (double)j;
-                for (size_t k = k0; k < k1; ++k) {
-                    boxcenter[2] = (double)k;
-                    int res = TriBoxOverlap(boxcenter, boxhalfsize, p[0], p[1], p[2]);
-                    unsigned char& value = GetVoxel(i, j, k);
-                    if (res == 1 && value == PRIMITIVE_UNDEFINED) {
-                        value = PRIMITIVE_ON_SURFACE;
-                        ++m_numVoxelsOnSurface;
-                    }
-                }
-            }
+    }
+
+    size_t numVoxelsOnSurface = 0;
+#if _OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(+ : numVoxelsOnSurface)
+#endif
+    for (int s = 0; s < (int)nSlabs; ++s) {
+        Vec3<double> p[3];
+        size_t i0, j0, k0;
+        size_t i1, j1, k1;
+        const size_t ks0 = s * slabSize;
+        const size_t ks1 = (ks0 + slabSize < m_dim[2]) ? ks0 + slabSize : m_dim[2];
+        const size_t nSlabTriangles = slabTriangles ? slabTriangles[s].Size() : nTriangles;
+        for (size_t t = 0; t < nSlabTriangles; ++t) {
+            const size_t tri = slabTriangles ? slabTriangles[s][t] : t;
+            const I* const corners = triangles + tri * strideTriangles;
+            const size_t triangle[3] = { (size_t)corners[0], (size_t)corners[1], (size_t)corners[2] };
+            ComputeTriangleBB(x, nPoints, triangle, p, i0, j0, k0, i1, j1, k1);
+            numVoxelsOnSurface += RasterizeTriangle(p, i0, j0, (k0 > ks0) ? k0 : ks0, i1, j1, (k1 < ks1) ? k1 : ks1);
         }
     }
-    FillOutsideSurface(0, 0, 0, m_dim[0], m_dim[1], 1);
-    FillOutsideSurface(0, 0, m_dim[2] - 1, m_dim[0], m_dim[1], m_dim[2]);
-    FillOutsideSurface(0, 0, 0, m_dim[0], 1, m_dim[2]);
-    FillOutsideSurface(0, m_dim[1] - 1, 0, m_dim[0], m_dim[1], m_dim[2]);
-    FillOutsideSurface(0, 0, 0, 1, m_dim[1], m_dim[2]);
-    FillOutsideSurface(m_dim[0] - 1, 0, 0, m_dim[0], m_dim[1], m_dim[2]);
+    m_numVoxelsOnSurface = numVoxelsOnSurface;
+    delete[] slabTriangles;
+
+    FillOutsideSurface();
     FillInsideSurface();
 }
 }
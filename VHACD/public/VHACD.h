@@ -71,6 +71,7 @@ public:
             m_convexhullApproximation = true;
             m_oclAcceleration = true;
             m_maxConvexHulls = 1024;
+            m_mortonOrder = 0; // 1: store the voxels column by column in Morton order
         }
         double m_concavity;
         double m_alpha;
@@ -89,9 +90,112 @@ public:
         int m_convexhullApproximation;
         int m_oclAcceleration;
         unsigned int	m_maxConvexHulls;
+        int m_mortonOrder;
+    };
+
+    class Stats {
+    public:
+        Stats(void) { Init(); }
+        void Init(void)
+        {
+            m_alignMeshTime = 0.0;
+            m_voxelizationTime = 0.0;
+            m_primitiveSetTime = 0.0;
+            m_acdTime = 0.0;
+            m_mergeTime = 0.0;
+            m_simplifyTime = 0.0;
+            m_totalTime = 0.0;
+            m_dim = 0;
+            m_nVoxelizations = 0;
+            m_nVoxelsOnSurface = 0;
+            m_nVoxelsInsideSurface = 0;
+            m_nPlanes = 0;
+            m_nConvexHullComputations = 0;
+            m_nConvexHullPoints = 0;
+            m_nMergeIterations = 0;
+        }
+        // elapsed time of each stage, in ms
+        double m_alignMeshTime;
+        double m_voxelizationTime;
+        double m_primitiveSetTime;
+        double m_acdTime;
+        double m_mergeTime;
+        double m_simplifyTime;
+        double m_totalTime;
+        unsigned int m_dim; // voxel grid dimension of the final voxelization
+        unsigned int m_nVoxelizations;
+        unsigned int m_nVoxelsOnSurface;
+        unsigned int m_nVoxelsInsideSurface;
+        unsigned int m_nPlanes; // candidate clipping planes evaluated
+        unsigned int m_nConvexHullComputations;
+        unsigned long long m_nConvexHullPoints; // points fed to the convex-hull computations
+        unsigned int m_nMergeIterations;
+    };
+
+    //! A triangle mesh that Compute reads in place, without copying or converting it. The coordinates of the point v
+    //! start v * m_pointStride bytes after m_points, the indices of the triangle t t * m_triangleStride bytes after
+    //! m_triangles; each stride is a multiple of the size of its elements. In asynchronous mode both buffers must
+    //! stay valid until the computation completes. Each voxelization stages the transformed points as three
+    //! doubles, 24 bytes per point.
+    class InputMesh {
+    public:
+        enum PointType {
+            POINT_FLOAT,
+            POINT_DOUBLE
+        };
+        enum IndexType {
+            INDEX_UINT16,
+            INDEX_UINT32
+        };
+        InputMesh(void)
+        {
+            m_points = 0;
+            m_pointType = POINT_FLOAT;
+            m_pointStride = 0;
+            m_nPoints = 0;
+            m_triangles = 0;
+            m_indexType = INDEX_UINT32;
+            m_triangleStride = 0;
+            m_nTriangles = 0;
+        }
+        //! The mesh of the Compute overloads below, whose strides count elements.
+        InputMesh(const float* const points, const unsigned int stridePoints, const unsigned int countPoints,
+            const int* const triangles, const unsigned int strideTriangles, const unsigned int countTriangles)
+        {
+            m_points = points;
+            m_pointType = POINT_FLOAT;
+            m_pointStride = stridePoints * (unsigned int)sizeof(float);
+            m_nPoints = countPoints;
+            m_triangles = triangles;
+            m_indexType = INDEX_UINT32;
+            m_triangleStride = strideTriangles * (unsigned int)sizeof(int);
+            m_nTriangles = countTriangles;
+        }
+        InputMesh(const double* const points, const unsigned int stridePoints, const unsigned int countPoints,
+            const int* const triangles, const unsigned int strideTriangles, const unsigned int countTriangles)
+        {
+            m_points = points;
+            m_pointType = POINT_DOUBLE;
+            m_pointStride = stridePoints * (unsigned int)sizeof(double);
+            m_nPoints = countPoints;
+            m_triangles = triangles;
+            m_indexType = INDEX_UINT32;
+            m_triangleStride = strideTriangles * (unsigned int)sizeof(int);
+            m_nTriangles = countTriangles;
+        }
+        const void* m_points;
+        PointType m_pointType;
+        unsigned int m_pointStride;
+        unsigned int m_nPoints;
+        const void* m_triangles;
+        IndexType m_indexType;
+        unsigned int m_triangleStride;
+        unsigned int m_nTriangles;
     };
 
     virtual void Cancel() = 0;
+    // The asynchronous interface reads points and triangles in place, from its background thread: they must stay
+    // valid until IsReady returns true.
     virtual bool Compute(const float* const points,
         const unsigned int stridePoints,
         const unsigned int countPoints,
@@ -108,8 +212,11 @@ public:
         const unsigned int countTriangles,
         const Parameters& params)
         = 0;
+    //! Returns false, computing nothing, if a stride of the mesh is not a multiple of the size of its elements.
+    virtual bool Compute(const InputMesh& mesh, const Parameters& params) = 0;
     virtual unsigned int GetNConvexHulls() const = 0;
     virtual void GetConvexHull(const unsigned int index, ConvexHull& ch) const = 0;
+    virtual void GetStats(Stats& stats) const = 0; // statistics of the last call to Compute
     virtual void Clean(void) = 0; // release internally allocated memory
     virtual void Release(void) = 0; // release IVHACD
     virtual bool OCLInit(void* const oclDevice,
@@ -131,5 +238,8 @@ protected:
 };
 IVHACD* CreateVHACD(void);
 IVHACD* CreateVHACD_ASYNC(void);
+// Synchronous (or asynchronous) interface with an on-disk cache: results of Compute are stored in
+// cacheDirectory and identical later requests are served from there without being recomputed.
+IVHACD* CreateVHACD_CACHE(const char* const cacheDirectory, const bool async = false);
 }
 #endif // VHACD_H
@@ -1,10 +1,11 @@
 #include "VHACD.h"
 #include <stdlib.h>
 #include <string.h>
+#include <float.h>
 #include <stdarg.h>
 #include <thread>
 #include <atomic>
-#include <chrono>
+#include <condition_variable>
 #include <mutex>
 #include <string>
 #include "MergeHulls.h"
@@ -108,8 +109,9 @@ public:
 
 	virtual ~MyHACD_API(void)
 	{
-		releaseHACD();
 		cancelThread();
+		releaseHACD();
+		stopThread();
 		mVHACD->Release();
 	}
 
@@ -122,33 +124,39 @@ public:
 		const unsigned int countTriangles,
 		const Parameters& _desc) final
 	{
+		return Compute(InputMesh(points, stridePoints, countPoints, triangles, strideTriangles, countTriangles), _desc);
+	}
+
+	virtual bool Compute(const InputMesh& mesh, const Parameters& _desc) final
+	{
 #if ENABLE_ASYNC
 		cancelThread(); // if we previously had a solution running; cancel it.
 		releaseHACD();
-		mRunning = true;
-		mThread = new std::thread([this, points, stridePoints, countPoints, triangles, strideTriangles, countTriangles, _desc]()
+		startThread();
 		{
-			ComputeNow(points, stridePoints, countPoints, triangles, strideTriangles, countTriangles, _desc);
-			mRunning = false;
-		});
+			std::lock_guard<std::mutex> lock(mJobMutex);
+			mJob.mMesh = mesh;
+			mJob.mParams = _desc;
+			mHaveJob = true;
+			mRunning = true;
+		}
+		mJobCondition.notify_one();
 #else
 		releaseHACD();
-		ComputeNow(points, stridePoints, countPoints, triangles, strideTriangles, countTriangles, _desc);
+		ComputeNow(mesh, _desc);
 #endif
 		return true;
 	}
 
-	bool ComputeNow(const double* const points,
-		const unsigned int stridePoints,
-		const unsigned int countPoints,
-		const int* const triangles,
-		const unsigned int strideTriangles,
-		const unsigned int countTriangles,
-		const Parameters& _desc) 
+	bool ComputeNow(const InputMesh& mesh, const Parameters& _desc)
 	{
 		uint32_t ret = 0;
 
 		mHullCount	= 0;
+		{
+			std::lock_guard<std::mutex> lock(mJobMutex);
+			mStats.Init();
+		}
 		mCallback	= _desc.m_callback;
 		mLogger		= _desc.m_logger;
 
@@ -158,9 +166,15 @@ public:
 		desc.m_callback = desc.m_callback ? this : nullptr;
 		desc.m_logger = desc.m_logger ? this : nullptr;
 
-		if ( countPoints )
+		if ( mesh.m_nPoints && !mCancel )
 		{
-			bool ok = mVHACD->Compute(points, stridePoints, countPoints, triangles, strideTriangles, countTriangles, desc);
+			bool ok = mVHACD->Compute(mesh, desc);
+			VHACD::IVHACD::Stats stats;
+			mVHACD->GetStats(stats);
+			{
+				std::lock_guard<std::mutex> lock(mJobMutex);
+				mStats = stats;
+			}
 			if (ok)
 			{
 				ret = mVHACD->GetNConvexHulls();
@@ -276,23 +290,73 @@ public:
 		}
 	}
 
+	// The worker thread writes the statistics of the job it runs under mJobMutex
+	virtual void GetStats(VHACD::IVHACD::Stats& stats) const final
+	{
+		std::lock_guard<std::mutex> lock(mJobMutex);
+		stats = mStats;
+	}
+
 	void cancelThread(void)
 	{
-		// If the thread is still running we need to cancel the operation and wait for it to complete.
+		// If a job is still pending or running we need to cancel the operation and wait for it to complete.
 		if (mRunning)
 		{
 			Cancel();
-			while (mRunning)
+			std::unique_lock<std::mutex> lock(mJobMutex);
+			if (mHaveJob) // the worker has not picked it up yet; drop it
 			{
-				using namespace std::chrono_literals;
-				std::this_thread::sleep_for(1ms);
+				mHaveJob = false;
+				mRunning = false;
 			}
-			delete mThread;
-			mThread = nullptr;
+			mDoneCondition.wait(lock, [this]() { return !mRunning; });
 			mCancel = false; // clear the cancel semaphore
 		}
 	}
 
+	// The worker thread is created with the first request and lives until the interface is released;
+	// every Compute call hands it one job.
+	void startThread(void)
+	{
+		if (!mThread.joinable())
+		{
+			mThread = std::thread(&MyHACD_API::workerThread, this);
+		}
+	}
+
+	void stopThread(void)
+	{
+		if (mThread.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> lock(mJobMutex);
+				mShutdown = true;
+			}
+			mJobCondition.notify_one();
+			mThread.join();
+		}
+	}
+
+	void workerThread(void)
+	{
+		std::unique_lock<std::mutex> lock(mJobMutex);
+		for (;;)
+		{
+			mJobCondition.wait(lock, [this]() { return mHaveJob || mShutdown; });
+			if (mShutdown)
+			{
+				break;
+			}
+			const Job job = mJob;
+			mHaveJob = false;
+			lock.unlock();
+			ComputeNow(job.mMesh, job.mParams);
+			lock.lock();
+			mRunning = false;
+			mDoneCondition.notify_all();
+		}
+	}
+
 	void	releaseHACD(void) // release memory associated with the last HACD request
 	{
 		if (mMergeHullsInterface)
@@ -307,8 +371,6 @@ public:
 		delete[]mHulls;
 		mHulls = nullptr;
 		mHullCount = 0;
-		HACD_FREE(mVertices);
-		mVertices = nullptr;
 	}
 
 
@@ -345,22 +407,7 @@ public:
 		const unsigned int countTriangles,
 		const Parameters& params) final
 	{
-
-		HACD_FREE(mVertices);
-		mVertices = (double *)HACD_ALLOC(sizeof(double)*countPoints * 3);
-		const float *source = points;
-		double *dest = mVertices;
-		for (uint32_t i = 0; i < countPoints; i++)
-		{
-			dest[0] = source[0];
-			dest[1] = source[1];
-			dest[2] = source[2];
-			dest += 3;
-			source += stridePoints;
-		}
-
-		return Compute(mVertices, 3, countPoints, triangles, strideTriangles, countTriangles, params);
-
+		return Compute(InputMesh(points, stridePoints, countPoints, triangles, strideTriangles, countTriangles), params);
 	}
 
 	virtual unsigned int GetNConvexHulls() const final
@@ -382,12 +429,12 @@ public:
 	}
 
 	virtual bool OCLInit(void* const oclDevice,
-		IUserLogger* const logger = 0) final
+		IVHACD::IUserLogger* const logger = 0) final
 	{
 		return mVHACD->OCLInit(oclDevice, logger);
 	}
 		
-	virtual bool OCLRelease(IUserLogger* const logger = 0) final
+	virtual bool OCLRelease(IVHACD::IUserLogger* const logger = 0) final
 	{
 		return mVHACD->OCLRelease(logger);
 	}
@@ -446,17 +493,33 @@ public:
 	}
 
 private:
+	// A decomposition request waiting for the worker thread
+	class Job
+	{
+	public:
+		InputMesh		mMesh;
+		Parameters		mParams;
+	};
+
 	MergeHullsInterface				*mMergeHullsInterface{ nullptr };
-	double							*mVertices{ nullptr };
 	std::atomic< uint32_t>			mHullCount{ 0 };
 	VHACD::IVHACD::ConvexHull		*mHulls{ nullptr };
+	VHACD::IVHACD::Stats			mStats;
 	VHACD::IVHACD::IUserCallback	*mCallback{ nullptr };
 	VHACD::IVHACD::IUserLogger		*mLogger{ nullptr };
 	VHACD::IVHACD					*mVHACD{ nullptr };
-	std::thread						*mThread{ nullptr };
 	std::atomic< bool >				mRunning{ false };
 	std::atomic<bool>				mCancel{ false };
 
+	// Worker thread and the job it is handed; mHaveJob, mShutdown and mStats are guarded by mJobMutex
+	std::thread						mThread;
+	mutable std::mutex				mJobMutex;
+	std::condition_variable			mJobCondition;	// signalled when a job is posted or on shutdown
+	std::condition_variable			mDoneCondition;	// signalled when a job completes
+	Job								mJob;
+	bool							mHaveJob{ false };
+	bool							mShutdown{ false };
+
 	// Thread safe caching mechanism for messages and update status.
 	// This is so that caller always gets messages in his own thread
 	// Member variables are marked as 'mutable' since the message dispatch function
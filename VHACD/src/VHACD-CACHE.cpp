@@ -0,0 +1,573 @@
+#include "VHACD.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <direct.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// On-disk cache of decomposition results.
+//
+// Every request is keyed by a 128 bit hash of its vertices, its triangles and the Parameters fields which
+// affect the result. A cache hit returns the convex hulls straight out of a memory mapped file named after
+// that key, without running the decomposition; a miss runs the wrapped IVHACD and stores its result.
+//
+// File layout (native endianness):
+//   CacheHeader
+//   CacheHull[hullCount]
+//   per hull: double points[3 * nPoints], int triangles[3 * nTriangles] padded to 8 bytes
+
+namespace VHACD
+{
+
+#define CACHE_MAGIC "VHACDCH"
+#define CACHE_FORMAT_VERSION 1
+
+struct CacheHeader
+{
+	char		mMagic[8];
+	uint32_t	mFormatVersion;
+	uint32_t	mHullCount;
+	uint64_t	mKey[2];
+};
+
+struct CacheHull
+{
+	uint64_t	mPointsOffset;
+	uint64_t	mTrianglesOffset;
+	uint32_t	mPointCount;
+	uint32_t	mTriangleCount;
+	double		mVolume;
+	double		mCenter[3];
+};
+
+// Two independent 64 bit lanes, each mixing one 64 bit word at a time.
+class CacheHasher
+{
+public:
+	CacheHasher(void)
+	{
+		mHash[0] = 0x9E3779B97F4A7C15ULL;
+		mHash[1] = 0xC2B2AE3D27D4EB4FULL;
+	}
+
+	void addWord(uint64_t w)
+	{
+		mHash[0] = mix(mHash[0] ^ (w * 0x87C37B91114253D5ULL));
+		mHash[1] = mix(mHash[1] + (w ^ 0x4CF5AD432745937FULL));
+	}
+
+	void addDouble(double d)
+	{
+		uint64_t w;
+		memcpy(&w, &d, sizeof(w));
+		addWord(w);
+	}
+
+	void getKey(uint64_t key[2]) const
+	{
+		key[0] = mix(mHash[0] ^ mHash[1]);
+		key[1] = mix(mHash[1] + key[0]);
+	}
+
+private:
+	static uint64_t mix(uint64_t h)
+	{
+		h ^= h >> 33;
+		h *= 0xFF51AFD7ED558CCDULL;
+		h ^= h >> 33;
+		h *= 0xC4CEB9FE1A85EC53ULL;
+		h ^= h >> 33;
+		return h;
+	}
+
+	uint64_t	mHash[2];
+};
+
+// Read only, copy on write, view of a cache file.
+class CacheFile
+{
+public:
+	CacheFile(const char *fname)
+	{
+#ifdef _WIN32
+		mFile = CreateFileA(fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (mFile == INVALID_HANDLE_VALUE)
+		{
+			return;
+		}
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(mFile, &size) || size.QuadPart == 0)
+		{
+			return;
+		}
+		mMapping = CreateFileMappingA(mFile, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+		if (mMapping)
+		{
+			mData = (uint8_t *)MapViewOfFile(mMapping, FILE_MAP_COPY, 0, 0, 0);
+			if (mData)
+			{
+				mLen = (size_t)size.QuadPart;
+			}
+		}
+#else
+		int fd = open(fname, O_RDONLY);
+		if (fd < 0)
+		{
+			return;
+		}
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			// Private writable mapping: the hulls handed out point into it and callers may modify them
+			void *data = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			if (data != MAP_FAILED)
+			{
+				mData = (uint8_t *)data;
+				mLen = (size_t)st.st_size;
+			}
+		}
+		close(fd);
+#endif
+	}
+
+	~CacheFile(void)
+	{
+#ifdef _WIN32
+		if (mData)
+		{
+			UnmapViewOfFile(mData);
+		}
+		if (mMapping)
+		{
+			CloseHandle(mMapping);
+		}
+		if (mFile != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(mFile);
+		}
+#else
+		if (mData)
+		{
+			munmap(mData, mLen);
+		}
+#endif
+	}
+
+	uint8_t		*mData{ nullptr };
+	size_t		mLen{ 0 };
+private:
+#ifdef _WIN32
+	HANDLE		mFile{ INVALID_HANDLE_VALUE };
+	HANDLE		mMapping{ nullptr };
+#endif
+};
+
+class MyHACD_CACHE : public VHACD::IVHACD
+{
+public:
+	MyHACD_CACHE(const char *cacheDirectory, bool async) : mDirectory(cacheDirectory ? cacheDirectory : "."), mAsync(async)
+	{
+		mVHACD = async ? CreateVHACD_ASYNC() : CreateVHACD();
+		if (!mDirectory.empty() && mDirectory[mDirectory.size() - 1] != '/' && mDirectory[mDirectory.size() - 1] != '\\')
+		{
+			mDirectory += '/';
+		}
+#ifdef _WIN32
+		_mkdir(mDirectory.c_str());
+#else
+		mkdir(mDirectory.c_str(), 0777);
+#endif
+	}
+
+	virtual ~MyHACD_CACHE(void)
+	{
+		releaseCached();
+		mVHACD->Release();
+	}
+
+	virtual void Cancel() final
+	{
+		mPendingStore = false;
+		mVHACD->Cancel();
+	}
+
+	virtual bool Compute(const float* const points,
+		const unsigned int stridePoints,
+		const unsigned int countPoints,
+		const int* const triangles,
+		const unsigned int strideTriangles,
+		const unsigned int countTriangles,
+		const Parameters& params) final
+	{
+		return Compute(InputMesh(points, stridePoints, countPoints, triangles, strideTriangles, countTriangles), params);
+	}
+
+	virtual bool Compute(const double* const points,
+		const unsigned int stridePoints,
+		const unsigned int countPoints,
+		const int* const triangles,
+		const unsigned int strideTriangles,
+		const unsigned int countTriangles,
+		const Parameters& params) final
+	{
+		return Compute(InputMesh(points, stridePoints, countPoints, triangles, strideTriangles, countTriangles), params);
+	}
+
+	virtual bool Compute(const InputMesh& mesh, const Parameters& params) final
+	{
+		const unsigned int pointSize = (mesh.m_pointType == InputMesh::POINT_DOUBLE) ? sizeof(double) : sizeof(float);
+		const unsigned int indexSize = (mesh.m_indexType == InputMesh::INDEX_UINT16) ? sizeof(uint16_t) : sizeof(uint32_t);
+		if (mesh.m_pointStride % pointSize != 0 || mesh.m_triangleStride % indexSize != 0)
+		{
+			releaseCached();
+			mPendingStore = false;
+			return mVHACD->Compute(mesh, params); // rejects the mesh
+		}
+		// Keyed on the points converted to double and the indices to 32 bits, as the decomposition sees them, so
+		// that every layout of the same mesh shares its entries
+		CacheHasher hasher;
+		const uint8_t *points = (const uint8_t *)mesh.m_points;
+		for (unsigned int i = 0; i < mesh.m_nPoints; i++)
+		{
+			if (mesh.m_pointType == InputMesh::POINT_DOUBLE)
+			{
+				const double *p = (const double *)&points[(size_t)i * mesh.m_pointStride];
+				hasher.addDouble(p[0]);
+				hasher.addDouble(p[1]);
+				hasher.addDouble(p[2]);
+			}
+			else
+			{
+				const float *p = (const float *)&points[(size_t)i * mesh.m_pointStride];
+				hasher.addDouble(p[0]);
+				hasher.addDouble(p[1]);
+				hasher.addDouble(p[2]);
+			}
+		}
+		if (lookup(hasher, mesh, params))
+		{
+			return true;
+		}
+		bool ret = mVHACD->Compute(mesh, params);
+		computed(ret);
+		return ret;
+	}
+
+	virtual unsigned int GetNConvexHulls() const final
+	{
+		if (mCached)
+		{
+			return mHullCount;
+		}
+		unsigned int ret = mVHACD->GetNConvexHulls();
+		storePending();
+		return ret;
+	}
+
+	virtual void GetConvexHull(const unsigned int index, ConvexHull& ch) const final
+	{
+		if (mCached)
+		{
+			if (index < mHullCount)
+			{
+				ch = mHulls[index];
+			}
+			return;
+		}
+		mVHACD->GetConvexHull(index, ch);
+	}
+
+	virtual void GetStats(Stats& stats) const final
+	{
+		if (mCached)
+		{
+			stats.Init(); // nothing was computed
+			return;
+		}
+		mVHACD->GetStats(stats);
+	}
+
+	virtual void Clean(void) final
+	{
+		releaseCached();
+		mPendingStore = false;
+		mVHACD->Clean();
+	}
+
+	virtual void Release(void) final
+	{
+		delete this;
+	}
+
+	virtual bool OCLInit(void* const oclDevice,
+		IVHACD::IUserLogger* const logger = 0) final
+	{
+		return mVHACD->OCLInit(oclDevice, logger);
+	}
+
+	virtual bool OCLRelease(IVHACD::IUserLogger* const logger = 0) final
+	{
+		return mVHACD->OCLRelease(logger);
+	}
+
+	virtual bool IsReady(void) const final
+	{
+		if (mCached)
+		{
+			return true;
+		}
+		bool ret = mVHACD->IsReady();
+		storePending();
+		return ret;
+	}
+
+private:
+	// Completes the key of a request with its triangles and parameters, and loads the cached result if any
+	bool lookup(CacheHasher &hasher, const InputMesh& mesh, const Parameters& params)
+	{
+		releaseCached();
+		mPendingStore = false;
+
+		hasher.addWord(mesh.m_nPoints);
+		hasher.addWord(mesh.m_nTriangles);
+		const uint8_t *triangles = (const uint8_t *)mesh.m_triangles;
+		for (unsigned int i = 0; i < mesh.m_nTriangles; i++)
+		{
+			uint32_t t[3];
+			if (mesh.m_indexType == InputMesh::INDEX_UINT16)
+			{
+				const uint16_t *src = (const uint16_t *)&triangles[(size_t)i * mesh.m_triangleStride];
+				t[0] = src[0];
+				t[1] = src[1];
+				t[2] = src[2];
+			}
+			else
+			{
+				const uint32_t *src = (const uint32_t *)&triangles[(size_t)i * mesh.m_triangleStride];
+				t[0] = src[0];
+				t[1] = src[1];
+				t[2] = src[2];
+			}
+			hasher.addWord((uint64_t)t[0] | ((uint64_t)t[1] << 32));
+			hasher.addWord(t[2]);
+		}
+		// Every parameter which changes the result; callbacks, loggers and the OpenCL switch do not. The
+		// asynchronous interface post-processes the hulls, so it has its own entries.
+		hasher.addWord((VHACD_VERSION_MAJOR << 16) | VHACD_VERSION_MINOR);
+		hasher.addWord(mAsync ? 1 : 0);
+		hasher.addDouble(params.m_concavity);
+		hasher.addDouble(params.m_alpha);
+		hasher.addDouble(params.m_beta);
+		hasher.addDouble(params.m_gamma);
+		hasher.addDouble(params.m_minVolumePerCH);
+		hasher.addWord(params.m_resolution);
+		hasher.addWord(params.m_maxNumVerticesPerCH);
+		hasher.addWord((uint32_t)params.m_depth);
+		hasher.addWord((uint32_t)params.m_planeDownsampling);
+		hasher.addWord((uint32_t)params.m_convexhullDownsampling);
+		hasher.addWord((uint32_t)params.m_pca);
+		hasher.addWord((uint32_t)params.m_mode);
+		hasher.addWord((uint32_t)params.m_convexhullApproximation);
+		hasher.addWord(params.m_maxConvexHulls);
+		hasher.addWord((uint32_t)params.m_mortonOrder);
+		hasher.getKey(mKey);
+
+		char name[64];
+		snprintf(name, sizeof(name), "%016llx%016llx.vhacd", (unsigned long long)mKey[0], (unsigned long long)mKey[1]);
+		mFileName = mDirectory + name;
+
+		CacheFile *file = new CacheFile(mFileName.c_str());
+		if (file->mData && load(*file))
+		{
+			mFile = file;
+			mCached = true;
+			if (params.m_callback)
+			{
+				params.m_callback->Update(100.0, 100.0, 100.0, "Cache", "Loaded cached convex hulls");
+			}
+			return true;
+		}
+		delete file;
+		return false;
+	}
+
+	bool load(const CacheFile &file)
+	{
+		if (file.mLen < sizeof(CacheHeader))
+		{
+			return false;
+		}
+		const CacheHeader *header = (const CacheHeader *)file.mData;
+		if (memcmp(header->mMagic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+			header->mFormatVersion != CACHE_FORMAT_VERSION ||
+			header->mKey[0] != mKey[0] || header->mKey[1] != mKey[1] ||
+			header->mHullCount > (file.mLen - sizeof(CacheHeader)) / sizeof(CacheHull))
+		{
+			return false;
+		}
+		const CacheHull *hulls = (const CacheHull *)(file.mData + sizeof(CacheHeader));
+		mHulls.resize(header->mHullCount);
+		for (uint32_t i = 0; i < header->mHullCount; i++)
+		{
+			const CacheHull &h = hulls[i];
+			if (h.mPointsOffset > file.mLen || uint64_t(h.mPointCount) * 3 * sizeof(double) > file.mLen - h.mPointsOffset ||
+				h.mTrianglesOffset > file.mLen || uint64_t(h.mTriangleCount) * 3 * sizeof(int) > file.mLen - h.mTrianglesOffset)
+			{
+				return false; // truncated or corrupt
+			}
+			ConvexHull &ch = mHulls[i];
+			ch.m_points = (double *)(file.mData + h.mPointsOffset);
+			ch.m_triangles = (int *)(file.mData + h.mTrianglesOffset);
+			ch.m_nPoints = h.mPointCount;
+			ch.m_nTriangles = h.mTriangleCount;
+			ch.m_volume = h.mVolume;
+			ch.m_center[0] = h.mCenter[0];
+			ch.m_center[1] = h.mCenter[1];
+			ch.m_center[2] = h.mCenter[2];
+		}
+		mHullCount = header->mHullCount;
+		return true;
+	}
+
+	// The wrapped interface has been handed a request; its result is stored once it is available
+	void computed(bool ok)
+	{
+		mPendingStore = ok;
+		storePending();
+	}
+
+	void storePending(void) const
+	{
+		if (mPendingStore && mVHACD->IsReady())
+		{
+			mPendingStore = false;
+			store();
+		}
+	}
+
+	// Writes the result of the wrapped interface to a temporary file which is then renamed into place, so
+	// that concurrent builds never see a partially written entry.
+	void store(void) const
+	{
+		const unsigned int hullCount = mVHACD->GetNConvexHulls();
+		if (hullCount == 0)
+		{
+			return;
+		}
+
+		CacheHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.mMagic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+		header.mFormatVersion = CACHE_FORMAT_VERSION;
+		header.mHullCount = hullCount;
+		header.mKey[0] = mKey[0];
+		header.mKey[1] = mKey[1];
+
+		std::vector< ConvexHull > hulls(hullCount);
+		std::vector< CacheHull > records(hullCount);
+		uint64_t offset = sizeof(CacheHeader) + sizeof(CacheHull) * hullCount;
+		for (unsigned int i = 0; i < hullCount; i++)
+		{
+			ConvexHull &ch = hulls[i];
+			memset(&ch, 0, sizeof(ch));
+			mVHACD->GetConvexHull(i, ch);
+			CacheHull &h = records[i];
+			memset(&h, 0, sizeof(h));
+			h.mPointCount = ch.m_nPoints;
+			h.mTriangleCount = ch.m_nTriangles;
+			h.mVolume = ch.m_volume;
+			h.mCenter[0] = ch.m_center[0];
+			h.mCenter[1] = ch.m_center[1];
+			h.mCenter[2] = ch.m_center[2];
+			h.mPointsOffset = offset;
+			offset += uint64_t(ch.m_nPoints) * 3 * sizeof(double);
+			h.mTrianglesOffset = offset;
+			offset += (uint64_t(ch.m_nTriangles) * 3 * sizeof(int) + 7) & ~uint64_t(7);
+		}
+
+		char suffix[64];
+#ifdef _WIN32
+		snprintf(suffix, sizeof(suffix), ".%d.%p.tmp", _getpid(), (const void *)this);
+#else
+		snprintf(suffix, sizeof(suffix), ".%d.%p.tmp", (int)getpid(), (const void *)this);
+#endif
+		const std::string tempName = mFileName + suffix;
+		FILE *fph = fopen(tempName.c_str(), "wb");
+		if (!fph)
+		{
+			return;
+		}
+		bool ok = fwrite(&header, sizeof(header), 1, fph) == 1 &&
+			fwrite(&records[0], sizeof(CacheHull), hullCount, fph) == hullCount;
+		for (unsigned int i = 0; i < hullCount && ok; i++)
+		{
+			const ConvexHull &ch = hulls[i];
+			const size_t padding = records[i].mTrianglesOffset + uint64_t(ch.m_nTriangles) * 3 * sizeof(int);
+			const size_t end = (i + 1 < hullCount) ? (size_t)records[i + 1].mPointsOffset : (size_t)offset;
+			static const uint8_t zeros[8] = { 0 };
+			ok = fwrite(ch.m_points, sizeof(double) * 3, ch.m_nPoints, fph) == ch.m_nPoints &&
+				fwrite(ch.m_triangles, sizeof(int) * 3, ch.m_nTriangles, fph) == ch.m_nTriangles &&
+				fwrite(zeros, 1, end - padding, fph) == end - padding;
+		}
+		ok = (fclose(fph) == 0) && ok;
+		if (!ok || !commitFile(tempName))
+		{
+			remove(tempName.c_str());
+		}
+	}
+
+	bool commitFile(const std::string &tempName) const
+	{
+#ifdef _WIN32
+		return MoveFileExA(tempName.c_str(), mFileName.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		return rename(tempName.c_str(), mFileName.c_str()) == 0;
+#endif
+	}
+
+	void releaseCached(void)
+	{
+		delete mFile;
+		mFile = nullptr;
+		mHulls.clear();
+		mHullCount = 0;
+		mCached = false;
+	}
+
+	std::string						mDirectory;
+	std::string						mFileName;	// cache entry of the current request
+	uint64_t						mKey[2]{ 0, 0 };
+	bool							mAsync;
+	IVHACD							*mVHACD{ nullptr };
+	CacheFile						*mFile{ nullptr };
+	std::vector< ConvexHull >		mHulls;
+	unsigned int					mHullCount{ 0 };
+	bool							mCached{ false };		// the current result comes from mFile
+	mutable bool					mPendingStore{ false };	// the current result must be stored once ready
+};
+
+IVHACD* CreateVHACD_CACHE(const char* const cacheDirectory, const bool async)
+{
+	MyHACD_CACHE *m = new MyHACD_CACHE(cacheDirectory, async);
+	return static_cast<IVHACD *>(m);
+}
+
+}; // end of VHACD namespace
@@ -19,7 +19,9 @@
 #include <fstream>
 #include <iomanip>
 #include <limits>
+#include <queue>
 #include <sstream>
+#include <vector>
 #if _OPENMP
 #include <omp.h>
 #endif // _OPENMP
@@ -44,91 +46,6 @@
 #define ZSGN(a) (((a) < 0) ? -1 : (a) > 0 ? 1 : 0)
 #define MAX_DOUBLE (1.79769e+308)
 
-#ifdef USE_SSE
-#include <immintrin.h>
-
-const int SIMD_WIDTH = 4;
-inline int FindMinimumElement(const float* const d, float* const m, const int n)
-{
-    // Min within vectors
-    __m128 min_i = _mm_set1_ps(-1.0f);
-    __m128 min_v = _mm_set1_ps(std::numeric_limits<float>::max());
-    for (int i = 0; i <= n - SIMD_WIDTH; i += SIMD_WIDTH) {
-        const __m128 data = _mm_load_ps(&d[i]);
-        const __m128 pred = _mm_cmplt_ps(data, min_v);
-
-        min_i = _mm_blendv_ps(min_i, _mm_set1_ps(i), pred);
-        min_v = _mm_min_ps(data, min_v);
-    }
-
-    /* Min within vector */
-    const __m128 min1 = _mm_shuffle_ps(min_v, min_v, _MM_SHUFFLE(1, 0, 3, 2));
-    const __m128 min2 = _mm_min_ps(min_v, min1);
-    const __m128 min3 = _mm_shuffle_ps(min2, min2, _MM_SHUFFLE(0, 1, 0, 1));
-    const __m128 min4 = _mm_min_ps(min2, min3);
-    float min_d = _mm_cvtss_f32(min4);
-
-    // Min index
-    const int min_idx = __builtin_ctz(_mm_movemask_ps(_mm_cmpeq_ps(min_v, min4)));
-    int ret = min_i[min_idx] + min_idx;
-
-    // Trailing elements
-    for (int i = (n & ~(SIMD_WIDTH - 1)); i < n; ++i) {
-        if (d[i] < min_d) {
-            min_d = d[i];
-            ret = i;
-        }
-    }
-
-    *m = min_d;
-    return ret;
-}
-
-inline int FindMinimumElement(const float* const d, float* const m, const int begin, const int end)
-{
-    // Leading elements
-    int min_i = -1;
-    float min_d = std::numeric_limits<float>::max();
-    const int aligned = (begin & ~(SIMD_WIDTH - 1)) + ((begin & (SIMD_WIDTH - 1)) ? SIMD_WIDTH : 0);
-    for (int i = begin; i < std::min(end, aligned); ++i) {
-        if (d[i] < min_d) {
-            min_d = d[i];
-            min_i = i;
-        }
-    }
-
-    // Middle and trailing elements
-    float r_m = std::numeric_limits<float>::max();
-    const int n = end - aligned;
-    const int r_i = (n > 0) ? FindMinimumElement(&d[aligned], &r_m, n) : 0;
-
-    // Pick the lowest
-    if (r_m < min_d) {
-        *m = r_m;
-        return r_i + aligned;
-    }
-    else {
-        *m = min_d;
-        return min_i;
-    }
-}
-#else
-inline int FindMinimumElement(const float* const d, float* const m, const int begin, const int end)
-{
-    int idx = -1;
-    float min = (std::numeric_limits<float>::max)();
-    for (size_t i = begin; i < end; ++i) {
-        if (d[i] < min) {
-            idx = i;
-            min = d[i];
-        }
-    }
-
-    *m = min;
-    return idx;
-}
-#endif
-
 //#define OCL_SOURCE_FROM_FILE
 #ifndef OCL_SOURCE_FROM_FILE
 const char* oclProgramSource = "\
@@ -389,6 +306,33 @@ bool VHACD::OCLRelease(IUserLogger* const logger)
     return false;
 #endif //CL_VERSION_1_1
 }
+size_t VHACD::PredictDim(const Volume& volume, const double referenceLength, const size_t minDim, const Parameters& params) const
+{
+    // With q the ratio of the voxel size of volume to the predicted one, the inside voxels scale as q^3 and the
+    // surface voxels as q^2: q solves (nInside * q + nSurface) * q^2 = resolution.
+    const double nInside = (double)volume.GetNPrimitivesInsideSurf();
+    const double nSurface = (double)volume.GetNPrimitivesOnSurf();
+    const double resolution = (double)params.m_resolution;
+    if (nSurface == 0.0 || referenceLength <= 0.0 || volume.GetScale() <= 0.0) {
+        return minDim;
+    }
+    double q0 = 0.0;
+    double q1 = sqrt(resolution / nSurface);
+    if (nInside > 0.0) {
+        q1 = MIN(q1, pow(resolution / nInside, 1.0 / 3.0));
+    }
+    for (int it = 0; it < 64; ++it) {
+        const double q = 0.5 * (q0 + q1);
+        if ((nInside * q + nSurface) * q * q < resolution) {
+            q0 = q;
+        }
+        else {
+            q1 = q;
+        }
+    }
+    // The reference length spans dim - 1 voxels; rounding down approaches params.m_resolution from below.
+    return MAX(minDim, (size_t)(referenceLength * q0 / volume.GetScale()) + 1);
+}
 void VHACD::ComputePrimitiveSet(const Parameters& params)
 {
     if (GetCancel()) {
@@ -408,7 +352,7 @@ void VHACD::ComputePrimitiveSet(const Parameters& params)
     Update(0.0, 0.0, params);
     if (params.m_mode == 0) {
         VoxelSet* vset = new VoxelSet;
-        m_volume->Convert(*vset);
+        m_volume->Convert(*vset, SVT_MAX_NUM_CELLS, params.m_mortonOrder != 0);
         m_pset = vset;
     }
     else {
@@ -431,21 +375,48 @@ void VHACD::ComputePrimitiveSet(const Parameters& params)
     m_overallProgress = 15.0;
     Update(100.0, 100.0, params);
     m_timer.Toc();
+    m_stats.m_primitiveSetTime = m_timer.GetElapsedTime();
     if (params.m_logger) {
         msg.str("");
         msg << "\t time " << m_timer.GetElapsedTime() / 1000.0 << "s" << std::endl;
         params.m_logger->Log(msg.str().c_str());
     }
 }
+// The int indices are read as uint32_t, which shares the instantiations with the 32-bit index buffers of Compute(InputMesh).
 bool VHACD::Compute(const double* const points, const unsigned int stridePoints, const unsigned int nPoints,
     const int* const triangles, const unsigned int strideTriangles, const unsigned int nTriangles, const Parameters& params)
 {
-    return ComputeACD(points, stridePoints, nPoints, triangles, strideTriangles, nTriangles, params);
+    return ComputeACD(points, stridePoints, nPoints, (const uint32_t*)triangles, strideTriangles, nTriangles, params);
 }
 bool VHACD::Compute(const float* const points, const unsigned int stridePoints, const unsigned int nPoints,
     const int* const triangles, const unsigned int strideTriangles, const unsigned int nTriangles, const Parameters& params)
 {
-    return ComputeACD(points, stridePoints, nPoints, triangles, strideTriangles, nTriangles, params);
+    return ComputeACD(points, stridePoints, nPoints, (const uint32_t*)triangles, strideTriangles, nTriangles, params);
+}
+bool VHACD::Compute(const InputMesh& mesh, const Parameters& params)
+{
+    // The decomposition indexes the buffers by element.
+    const unsigned int pointSize = (mesh.m_pointType == InputMesh::POINT_DOUBLE) ? sizeof(double) : sizeof(float);
+    const unsigned int indexSize = (mesh.m_indexType == InputMesh::INDEX_UINT16) ? sizeof(uint16_t) : sizeof(uint32_t);
+    if (mesh.m_pointStride % pointSize != 0 || mesh.m_triangleStride % indexSize != 0) {
+        return false;
+    }
+    const unsigned int stridePoints = mesh.m_pointStride / pointSize;
+    const unsigned int strideTriangles = mesh.m_triangleStride / indexSize;
+    if (mesh.m_pointType == InputMesh::POINT_DOUBLE) {
+        if (mesh.m_indexType == InputMesh::INDEX_UINT16) {
+            return ComputeACD((const double*)mesh.m_points, stridePoints, mesh.m_nPoints,
+                (const uint16_t*)mesh.m_triangles, strideTriangles, mesh.m_nTriangles, params);
+        }
+        return ComputeACD((const double*)mesh.m_points, stridePoints, mesh.m_nPoints,
+            (const uint32_t*)mesh.m_triangles, strideTriangles, mesh.m_nTriangles, params);
+    }
+    if (mesh.m_indexType == InputMesh::INDEX_UINT16) {
+        return ComputeACD((const float*)mesh.m_points, stridePoints, mesh.m_nPoints,
+            (const uint16_t*)mesh.m_triangles, strideTriangles, mesh.m_nTriangles, params);
+    }
+    return ComputeACD((const float*)mesh.m_points, stridePoints, mesh.m_nPoints,
+        (const uint32_t*)mesh.m_triangles, strideTriangles, mesh.m_nTriangles, params);
 }
 double ComputePreferredCuttingDirection(const PrimitiveSet* const tset, Vec3<double>& dir)
 {
@@ -679,7 +650,7 @@ inline double ComputeConcavity(const double volume, const double volumeCH, const
 void VHACD::ComputeBestClippingPlane(const PrimitiveSet* inputPSet, const double volume, const SArray<Plane>& planes,
     const Vec3<double>& preferredCuttingDirection, const double w, const double alpha, const double beta,
     const int convexhullDownsampling, const double progress0, const double progress1, Plane& bestPlane,
-    double& minConcavity, const Parameters& params)
+    double& minConcavity, Mesh* const bestLeftCH, Mesh* const bestRightCH, const Parameters& params)
 {
     if (GetCancel()) {
         return;
@@ -695,6 +666,14 @@ void VHACD::ComputeBestClippingPlane(const PrimitiveSet* inputPSet, const double
     double minBalance = MAX_DOUBLE;
     double minSymmetry = MAX_DOUBLE;
     minConcavity = MAX_DOUBLE;
+#if USE_THREAD == 1 && _OPENMP
+#pragma omp atomic
+#endif
+    m_stats.m_nPlanes += nPlanes;
+    if (bestLeftCH) {
+        bestLeftCH->Clear();
+        bestRightCH->Clear();
+    }
 
     SArray<Vec3<double> >* chPts = new SArray<Vec3<double> >[2 * m_ompNumProcessors];
     Mesh* chs = new Mesh[2 * m_ompNumProcessors];
@@ -726,10 +705,12 @@ void VHACD::ComputeBestClippingPlane(const PrimitiveSet* inputPSet, const double
         nWorkGroups = (nPrimitives + 4 * m_oclWorkGroupSize - 1) / (4 * m_oclWorkGroupSize);
         globalSize = nWorkGroups * m_oclWorkGroupSize;
         cl_int error;
+        SArray<Voxel, 8> hostVoxels;
+        vset->GetVoxels(hostVoxels);
         voxels = clCreateBuffer(m_oclContext,
             CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
             sizeof(Voxel) * nPrimitives,
-            vset->GetVoxels(),
+            hostVoxels.Data(),
             &error);
         if (error != CL_SUCCESS) {
             if (params.m_logger) {
@@ -772,12 +753,21 @@ void VHACD::ComputeBestClippingPlane(const PrimitiveSet* inputPSet, const double
     oclAcceleration = false;
 #endif // CL_VERSION_1_1
 
+    // plane volume table: clipped volumes for all the candidate planes
+    SArray<double> volumesRight;
+    SArray<double> volumesLeft;
+    if (!oclAcceleration) {
+        inputPSet->ComputeClippedVolumes(planes, volumesRight, volumesLeft);
+    }
+
 #ifdef DEBUG_TEMP
     Timer timerComputeCost;
     timerComputeCost.Tic();
 #endif // DEBUG_TEMP
 
-#if USE_THREAD == 1 && _OPENMP
+#if USE_TASKS == 1
+#pragma omp taskloop default(shared)
+#elif USE_THREAD == 1 && _OPENMP
 #pragma omp parallel for
 #endif
     for (int x = 0; x < nPlanes; ++x) {
@@ -860,6 +850,7 @@ void VHACD::ComputeBestClippingPlane(const PrimitiveSet* inputPSet, const double
                 inputPSet->GetConvexHull().Clip(plane, rightCHPts, leftCHPts);
                 rightCH.ComputeConvexHull((double*)rightCHPts.Data(), rightCHPts.Size());
                 leftCH.ComputeConvexHull((double*)leftCHPts.Data(), leftCHPts.Size());
+                AddConvexHullStats(2, rightCHPts.Size() + leftCHPts.Size());
 #ifdef TEST_APPROX_CH
                 Mesh leftCH1;
                 Mesh rightCH1;
@@ -877,8 +868,9 @@ void VHACD::ComputeBestClippingPlane(const PrimitiveSet* inputPSet, const double
                 PrimitiveSet* const right = psets[threadID];
                 PrimitiveSet* const left = psets[threadID + m_ompNumProcessors];
                 onSurfacePSet->Clip(plane, right, left);
-                right->ComputeConvexHull(rightCH, convexhullDownsampling);
-                left->ComputeConvexHull(leftCH, convexhullDownsampling);
+                const size_t nRightPts = right->ComputeConvexHull(rightCH, convexhullDownsampling);
+                const size_t nLeftPts = left->ComputeConvexHull(leftCH, convexhullDownsampling);
+                AddConvexHullStats(2, nRightPts + nLeftPts);
             }
             double volumeLeftCH = leftCH.ComputeVolume();
             double volumeRightCH = rightCH.ComputeVolume();
@@ -904,7 +896,8 @@ void VHACD::ComputeBestClippingPlane(const PrimitiveSet* inputPSet, const double
 #endif // CL_VERSION_1_1
             }
             else {
-                inputPSet->ComputeClippedVolumes(plane, volumeRight, volumeLeft);
+                volumeRight = volumesRight[x];
+                volumeLeft = volumesLeft[x];
             }
             double concavityLeft = ComputeConcavity(volumeLeft, volumeLeftCH, m_volumeCH0);
             double concavityRight = ComputeConcavity(volumeRight, volumeRightCH, m_volumeCH0);
@@ -927,6 +920,10 @@ void VHACD::ComputeBestClippingPlane(const PrimitiveSet* inputPSet, const double
                     bestPlane = plane;
                     minTotal = total;
                     iBest = x;
+                    if (bestLeftCH) {
+                        *bestLeftCH = leftCH;
+                        *bestRightCH = rightCH;
+                    }
                 }
                 ++done;
                 if (!(done & 127)) // reduce update frequency
@@ -964,34 +961,288 @@ void VHACD::ComputeBestClippingPlane(const PrimitiveSet* inputPSet, const double
     delete[] chs;
     if (params.m_logger) {
         sprintf(msg, "\n\t\t\t Best  %04i T=%2.6f C=%2.6f B=%2.6f S=%2.6f (%1.1f, %1.1f, %1.1f, %3.3f)\n\n", iBest, minTotal, minConcavity, minBalance, minSymmetry, bestPlane.m_a, bestPlane.m_b, bestPlane.m_c, bestPlane.m_d);
+#if USE_THREAD == 1 && _OPENMP
+#pragma omp critical
+#endif
         params.m_logger->Log(msg);
     }
 }
-void VHACD::ComputeACD(const Parameters& params)
+size_t CompleteConvexHull(const VoxelSet& vset, const Plane& plane, const Mesh& sideCH, Mesh& meshCH)
 {
-    if (GetCancel()) {
-        return;
+    // vset was clipped from a set whose on-surface voxels lying on its side have sideCH as convex-hull.
+    // Clipping only adds the voxels along the plane to the surface, so the hull of vset is the hull of
+    // sideCH and of these voxels. It is not bit-identical to VoxelSet::ComputeConvexHull: btConvexHullComputer
+    // drops a few vertices of nearly coplanar faces each time a hull is computed from hull vertices, so the
+    // volume differs by about 1e-4 and the decomposition may then choose other planes.
+    SArray<Vec3<double> > pts;
+    sideCH.CopyPoints(pts);
+    const double d0 = vset.GetScale();
+    Vec3<double> corners[8];
+    Voxel voxel;
+    VoxelSet::Iterator it(vset, true);
+    while (it.Next(voxel)) {
+        if (voxel.m_data != PRIMITIVE_ON_SURFACE) {
+            continue;
+        }
+        const Vec3<double> pt = vset.GetPoint(voxel);
+        const double d = plane.m_a * pt[0] + plane.m_b * pt[1] + plane.m_c * pt[2] + plane.m_d;
+        if (d <= d0 && -d <= d0) {
+            vset.GetPoints(voxel, corners);
+            for (int c = 0; c < 8; ++c) {
+                pts.PushBack(corners[c]);
+            }
+        }
     }
-    m_timer.Tic();
-
-    m_stage = "Approximate Convex Decomposition";
-    m_stageProgress = 0.0;
+    meshCH.ComputeConvexHull((double*)pts.Data(), pts.Size());
+    return pts.Size();
+}
+bool VHACD::SubdividePart(PrimitiveSet* const pset, const bool firstPart, const char* const partName,
+    const double progress0, const double progress1, const double progress2, PrimitiveSet*& bestLeft,
+    PrimitiveSet*& bestRight, double& minConcavity, const Parameters& params)
+{
+    // Returns true if pset was split into bestLeft and bestRight (pset is released), and false if pset is
+    // a final part. If the decomposition was cancelled, pset is released and no part is returned.
+    bestLeft = 0;
+    bestRight = 0;
+    minConcavity = MAX_DOUBLE;
     std::ostringstream msg;
+#if USE_THREAD == 1 && _OPENMP
+#pragma omp critical
+#endif
+    Update(m_stageProgress, progress0, params);
+
+    double volume = pset->ComputeVolume();
+    pset->ComputeBB();
+    pset->ComputePrincipalAxes();
+    if (params.m_pca) {
+        pset->AlignToPrincipalAxes();
+    }
+
+    if (pset->GetConvexHull().GetNPoints() == 0) {
+        AddConvexHullStats(1, pset->ComputeConvexHull(pset->GetConvexHull()));
+    }
+    double volumeCH = fabs(pset->GetConvexHull().ComputeVolume());
+    if (firstPart) {
+        m_volumeCH0 = volumeCH;
+    }
+
+    double concavity = ComputeConcavity(volume, volumeCH, m_volumeCH0);
+    double error = 1.01 * pset->ComputeMaxVolumeError() / m_volumeCH0;
+
     if (params.m_logger) {
-        msg << "+ " << m_stage << std::endl;
+        msg << "\t -> Part[" << partName
+            << "] C  = " << concavity
+            << ", E  = " << error
+            << ", VS = " << pset->GetNPrimitivesOnSurf()
+            << ", VI = " << pset->GetNPrimitivesInsideSurf()
+            << std::endl;
+#if USE_THREAD == 1 && _OPENMP
+#pragma omp critical
+#endif
         params.m_logger->Log(msg.str().c_str());
     }
 
-    SArray<PrimitiveSet*> parts;
+    if (concavity > params.m_concavity && concavity > error) {
+        Vec3<double> preferredCuttingDirection;
+        double w = ComputePreferredCuttingDirection(pset, preferredCuttingDirection);
+        SArray<Plane> planes;
+        if (params.m_mode == 0) {
+            VoxelSet* vset = (VoxelSet*)pset;
+            ComputeAxesAlignedClippingPlanes(*vset, params.m_planeDownsampling, planes);
+            if (params.m_convexhullApproximation && !vset->HasSurfaceCoordinates()) {
+                // every candidate plane intersects the surface voxels; Clip keeps the coordinates for the parts
+                vset->ComputeSurfaceCoordinates();
+            }
+        }
+        else {
+            TetrahedronSet* tset = (TetrahedronSet*)pset;
+            ComputeAxesAlignedClippingPlanes(*tset, params.m_planeDownsampling, planes);
+        }
+
+        if (params.m_logger) {
+            msg.str("");
+            msg << "\t\t [Regular sampling] Number of clipping planes " << planes.Size() << std::endl;
+#if USE_THREAD == 1 && _OPENMP
+#pragma omp critical
+#endif
+            params.m_logger->Log(msg.str().c_str());
+        }
+
+        // Without approximation, the hulls evaluated at full sampling for the best plane are the hulls of the
+        // parent's surface on each side, from which the hulls of the parts are completed.
+        const bool refine = params.m_planeDownsampling > 1 || params.m_convexhullDownsampling > 1;
+        const bool keepHulls = params.m_mode == 0 && !params.m_convexhullApproximation;
+        Mesh bestLeftCH;
+        Mesh bestRightCH;
+        Plane bestPlane;
+        ComputeBestClippingPlane(pset,
+            volume,
+            planes,
+            preferredCuttingDirection,
+            w,
+            concavity * params.m_alpha,
+            concavity * params.m_beta,
+            params.m_convexhullDownsampling,
+            progress0,
+            progress1,
+            bestPlane,
+            minConcavity,
+            (keepHulls && !refine) ? &bestLeftCH : 0,
+            (keepHulls && !refine) ? &bestRightCH : 0,
+            params);
+        if (!m_cancel && refine) {
+            SArray<Plane> planesRef;
+
+            if (params.m_mode == 0) {
+                VoxelSet* vset = (VoxelSet*)pset;
+                RefineAxesAlignedClippingPlanes(*vset, bestPlane, params.m_planeDownsampling, planesRef);
+            }
+            else {
+                TetrahedronSet* tset = (TetrahedronSet*)pset;
+                RefineAxesAlignedClippingPlanes(*tset, bestPlane, params.m_planeDownsampling, planesRef);
+            }
+
+            if (params.m_logger) {
+                msg.str("");
+                msg << "\t\t [Refining] Number of clipping planes " << planesRef.Size() << std::endl;
+#if USE_THREAD == 1 && _OPENMP
+#pragma omp critical
+#endif
+                params.m_logger->Log(msg.str().c_str());
+            }
+            ComputeBestClippingPlane(pset,
+                volume,
+                planesRef,
+                preferredCuttingDirection,
+                w,
+                concavity * params.m_alpha,
+                concavity * params.m_beta,
+                1, // convexhullDownsampling = 1
+                progress1,
+                progress2,
+                bestPlane,
+                minConcavity,
+                keepHulls ? &bestLeftCH : 0,
+                keepHulls ? &bestRightCH : 0,
+                params);
+        }
+        if (GetCancel()) {
+            delete pset; // clean up
+            return true;
+        }
+        bestLeft = pset->Create();
+        bestRight = pset->Create();
+        pset->Clip(bestPlane, bestRight, bestLeft);
+        if (bestLeftCH.GetNPoints() > 0 && bestRightCH.GetNPoints() > 0) {
+            AddConvexHullStats(1, CompleteConvexHull(*(VoxelSet*)bestRight, bestPlane, bestRightCH, bestRight->GetConvexHull()));
+            AddConvexHullStats(1, CompleteConvexHull(*(VoxelSet*)bestLeft, bestPlane, bestLeftCH, bestLeft->GetConvexHull()));
+        }
+        if (params.m_pca) {
+            bestRight->RevertAlignToPrincipalAxes();
+            bestLeft->RevertAlignToPrincipalAxes();
+        }
+        delete pset;
+        return true;
+    }
+    if (params.m_pca) {
+        pset->RevertAlignToPrincipalAxes();
+    }
+    return false;
+}
+#if USE_TASKS == 1
+void VHACD::SubdividePartTask(PrimitiveSet* const pset, const int sub, const std::string& path,
+    std::vector<PartRecord>& parts, const Parameters& params)
+{
+    // Each part is a task spawning one task per child. Parts are tagged with their subdivision level and
+    // their left(0)/right(1) path from the root, which gives back the order of the level-synchronous loop.
+    PartRecord part;
+    part.m_pset = pset;
+    part.m_level = sub;
+    part.m_path = path;
+    if (GetCancel()) {
+        delete pset;
+        FinishPartTask(sub, false, 0.0, params);
+        return;
+    }
+    if (sub <= params.m_depth) {
+        double progress0;
+        double progress1;
+        double progress2;
+#pragma omp critical
+        {
+            progress0 = m_nDoneParts * 100.0 / m_nParts;
+            progress1 = (m_nDoneParts + 0.75) * 100.0 / m_nParts;
+            progress2 = (m_nDoneParts + 1.00) * 100.0 / m_nParts;
+        }
+        PrimitiveSet* bestLeft;
+        PrimitiveSet* bestRight;
+        double minConcavity;
+        const char* const partName = (sub == 1) ? "root" : path.c_str();
+        if (SubdividePart(pset, sub == 1, partName, progress0, progress1, progress2, bestLeft, bestRight,
+                minConcavity, params)) {
+            if (bestLeft) {
+                const std::string pathLeft(path + '0');
+                const std::string pathRight(path + '1');
+                FinishPartTask(sub, true, minConcavity, params);
+#pragma omp task firstprivate(bestLeft, pathLeft) shared(parts, params)
+                SubdividePartTask(bestLeft, sub + 1, pathLeft, parts, params);
+#pragma omp task firstprivate(bestRight, pathRight) shared(parts, params)
+                SubdividePartTask(bestRight, sub + 1, pathRight, parts, params);
+            }
+            else {
+                FinishPartTask(sub, false, 0.0, params);
+            }
+            return;
+        }
+    }
+#pragma omp critical
+    parts.push_back(part);
+    FinishPartTask(sub, false, 0.0, params);
+}
+void VHACD::FinishPartTask(const int sub, const bool split, const double minConcavity, const Parameters& params)
+{
+    std::ostringstream msg;
+#pragma omp critical
+    {
+        LevelProgress& level = m_levels[sub - 1];
+        if (split) {
+            if (level.m_maxConcavity < minConcavity) {
+                level.m_maxConcavity = minConcavity;
+            }
+            if (m_levels[sub].m_nParts == 0 && sub < params.m_depth) {
+                // first part of the next level
+                msg << "Subdivision level " << sub + 1;
+                m_operation = msg.str();
+                if (params.m_logger) {
+                    msg.str("");
+                    msg << "\t Subdivision level " << sub + 1 << std::endl;
+                    params.m_logger->Log(msg.str().c_str());
+                }
+            }
+            m_levels[sub].m_nParts += 2;
+            m_nParts += 2;
+        }
+        ++level.m_nDoneParts;
+        ++m_nDoneParts;
+        Update(m_stageProgress, m_nDoneParts * 100.0 / m_nParts, params);
+
+        // Once all the parts of a level are done, no part can be added to the next one.
+        while (m_nCompleteLevels < (size_t)params.m_depth && m_levels[m_nCompleteLevels].m_nParts > 0
+            && m_levels[m_nCompleteLevels].m_nDoneParts == m_levels[m_nCompleteLevels].m_nParts) {
+            const double maxConcavity = m_levels[m_nCompleteLevels++].m_maxConcavity;
+            Update(95.0 * (1.0 - maxConcavity) / (1.0 - params.m_concavity), m_operationProgress, params);
+        }
+    }
+}
+#endif //USE_TASKS == 1
+void VHACD::SubdivideLevels(PrimitiveSet* const root, SArray<PrimitiveSet*>& parts, const Parameters& params)
+{
+    std::ostringstream msg;
     SArray<PrimitiveSet*> inputParts;
     SArray<PrimitiveSet*> temp;
-    inputParts.PushBack(m_pset);
-    m_pset = 0;
-    SArray<Plane> planes;
-    SArray<Plane> planesRef;
+    inputParts.PushBack(root);
     int sub = 0;
     bool firstIteration = true;
-    m_volumeCH0 = 1.0;
     while (sub++ < params.m_depth && inputParts.Size() > 0 && !m_cancel) {
         msg.str("");
         msg << "Subdivision level " << sub;
@@ -1011,132 +1262,28 @@ void VHACD::ComputeACD(const Parameters& params)
             const double progress1 = (p + 0.75) * 100.0 / nInputParts;
             const double progress2 = (p + 1.00) * 100.0 / nInputParts;
 
-            Update(m_stageProgress, progress0, params);
-
             PrimitiveSet* pset = inputParts[p];
             inputParts[p] = 0;
-            double volume = pset->ComputeVolume();
-            pset->ComputeBB();
-            pset->ComputePrincipalAxes();
-            if (params.m_pca) {
-                pset->AlignToPrincipalAxes();
-            }
-
-            pset->ComputeConvexHull(pset->GetConvexHull());
-            double volumeCH = fabs(pset->GetConvexHull().ComputeVolume());
-            if (firstIteration) {
-                m_volumeCH0 = volumeCH;
-            }
-
-            double concavity = ComputeConcavity(volume, volumeCH, m_volumeCH0);
-            double error = 1.01 * pset->ComputeMaxVolumeError() / m_volumeCH0;
-
-            if (firstIteration) {
-                firstIteration = false;
-            }
-
-            if (params.m_logger) {
-                msg.str("");
-                msg << "\t -> Part[" << p
-                    << "] C  = " << concavity
-                    << ", E  = " << error
-                    << ", VS = " << pset->GetNPrimitivesOnSurf()
-                    << ", VI = " << pset->GetNPrimitivesInsideSurf()
-                    << std::endl;
-                params.m_logger->Log(msg.str().c_str());
-            }
-
-            if (concavity > params.m_concavity && concavity > error) {
-                Vec3<double> preferredCuttingDirection;
-                double w = ComputePreferredCuttingDirection(pset, preferredCuttingDirection);
-                planes.Resize(0);
-                if (params.m_mode == 0) {
-                    VoxelSet* vset = (VoxelSet*)pset;
-                    ComputeAxesAlignedClippingPlanes(*vset, params.m_planeDownsampling, planes);
-                }
-                else {
-                    TetrahedronSet* tset = (TetrahedronSet*)pset;
-                    ComputeAxesAlignedClippingPlanes(*tset, params.m_planeDownsampling, planes);
-                }
-
-                if (params.m_logger) {
-                    msg.str("");
-                    msg << "\t\t [Regular sampling] Number of clipping planes " << planes.Size() << std::endl;
-                    params.m_logger->Log(msg.str().c_str());
-                }
-
-                Plane bestPlane;
-                double minConcavity = MAX_DOUBLE;
-                ComputeBestClippingPlane(pset,
-                    volume,
-                    planes,
-                    preferredCuttingDirection,
-                    w,
-                    concavity * params.m_alpha,
-                    concavity * params.m_beta,
-                    params.m_convexhullDownsampling,
-                    progress0,
-                    progress1,
-                    bestPlane,
-                    minConcavity,
-                    params);
-                if (!m_cancel && (params.m_planeDownsampling > 1 || params.m_convexhullDownsampling > 1)) {
-                    planesRef.Resize(0);
-
-                    if (params.m_mode == 0) {
-                        VoxelSet* vset = (VoxelSet*)pset;
-                        RefineAxesAlignedClippingPlanes(*vset, bestPlane, params.m_planeDownsampling, planesRef);
-                    }
-                    else {
-                        TetrahedronSet* tset = (TetrahedronSet*)pset;
-                        RefineAxesAlignedClippingPlanes(*tset, bestPlane, params.m_planeDownsampling, planesRef);
-                    }
-
-                    if (params.m_logger) {
-                        msg.str("");
-                        msg << "\t\t [Refining] Number of clipping planes " << planesRef.Size() << std::endl;
-                        params.m_logger->Log(msg.str().c_str());
-                    }
-                    ComputeBestClippingPlane(pset,
-                        volume,
-                        planesRef,
-                        preferredCuttingDirection,
-                        w,
-                        concavity * params.m_alpha,
-                        concavity * params.m_beta,
-                        1, // convexhullDownsampling = 1
-                        progress1,
-                        progress2,
-                        bestPlane,
-                        minConcavity,
-                        params);
-                }
-                if (GetCancel()) {
-                    delete pset; // clean up
+            msg.str("");
+            msg << p;
+            PrimitiveSet* bestLeft;
+            PrimitiveSet* bestRight;
+            double minConcavity;
+            if (SubdividePart(pset, firstIteration, msg.str().c_str(), progress0, progress1, progress2,
+                    bestLeft, bestRight, minConcavity, params)) {
+                if (!bestLeft) { // cancelled
                     break;
                 }
-                else {
-                    if (maxConcavity < minConcavity) {
-                        maxConcavity = minConcavity;
-                    }
-                    PrimitiveSet* bestLeft = pset->Create();
-                    PrimitiveSet* bestRight = pset->Create();
-                    temp.PushBack(bestLeft);
-                    temp.PushBack(bestRight);
-                    pset->Clip(bestPlane, bestRight, bestLeft);
-                    if (params.m_pca) {
-                        bestRight->RevertAlignToPrincipalAxes();
-                        bestLeft->RevertAlignToPrincipalAxes();
-                    }
-                    delete pset;
+                if (maxConcavity < minConcavity) {
+                    maxConcavity = minConcavity;
                 }
+                temp.PushBack(bestLeft);
+                temp.PushBack(bestRight);
             }
             else {
-                if (params.m_pca) {
-                    pset->RevertAlignToPrincipalAxes();
-                }
                 parts.PushBack(pset);
             }
+            firstIteration = false;
         }
 
         Update(95.0 * (1.0 - maxConcavity) / (1.0 - params.m_concavity), 100.0, params);
@@ -1156,6 +1303,63 @@ void VHACD::ComputeACD(const Parameters& params)
     for (size_t p = 0; p < nInputParts; ++p) {
         parts.PushBack(inputParts[p]);
     }
+}
+void VHACD::ComputeACD(const Parameters& params)
+{
+    if (GetCancel()) {
+        return;
+    }
+    m_timer.Tic();
+
+    m_stage = "Approximate Convex Decomposition";
+    m_stageProgress = 0.0;
+    std::ostringstream msg;
+    if (params.m_logger) {
+        msg << "+ " << m_stage << std::endl;
+        params.m_logger->Log(msg.str().c_str());
+    }
+
+    SArray<PrimitiveSet*> parts;
+    PrimitiveSet* const pset = m_pset;
+    m_pset = 0;
+    m_volumeCH0 = 1.0;
+#if USE_TASKS == 1
+    bool useTasks = true;
+#ifdef CL_VERSION_1_1
+    // the OpenCL kernel arguments are set per part and cannot be shared by concurrent parts
+    useTasks = !params.m_oclAcceleration;
+#endif //CL_VERSION_1_1
+    std::vector<PartRecord> records;
+#pragma omp parallel
+#pragma omp single
+    {
+        if (useTasks) {
+            LevelProgress empty = { 0, 0, 0.0 };
+            m_levels.assign(params.m_depth + 2, empty);
+            m_levels[0].m_nParts = 1;
+            m_nCompleteLevels = 0;
+            m_nParts = 1;
+            m_nDoneParts = 0;
+            m_operation = "Subdivision level 1";
+            if (params.m_logger && params.m_depth > 0) {
+                msg.str("");
+                msg << "\t Subdivision level 1" << std::endl;
+                params.m_logger->Log(msg.str().c_str());
+            }
+            Update(m_stageProgress, 0.0, params);
+            SubdividePartTask(pset, 1, std::string(), records, params);
+        }
+        else {
+            SubdivideLevels(pset, parts, params);
+        }
+    }
+    std::sort(records.begin(), records.end());
+    for (size_t p = 0; p < records.size(); ++p) {
+        parts.PushBack(records[p].m_pset);
+    }
+#else //USE_TASKS == 1
+    SubdivideLevels(pset, parts, params);
+#endif //USE_TASKS == 1
 
     if (GetCancel()) {
         const size_t nParts = parts.Size();
@@ -1183,7 +1387,12 @@ void VHACD::ComputeACD(const Parameters& params)
     for (size_t p = 0; p < nConvexHulls && !m_cancel; ++p) {
         Update(m_stageProgress, p * 100.0 / nConvexHulls, params);
         m_convexHulls.PushBack(new Mesh);
-        parts[p]->ComputeConvexHull(*m_convexHulls[p]);
+        if (parts[p]->GetConvexHull().GetNPoints() > 0) {
+            *m_convexHulls[p] = parts[p]->GetConvexHull();
+        }
+        else {
+            AddConvexHullStats(1, parts[p]->ComputeConvexHull(*m_convexHulls[p]));
+        }
         size_t nv = m_convexHulls[p]->GetNPoints();
         double x, y, z;
         for (size_t i = 0; i < nv; ++i) {
@@ -1216,6 +1425,7 @@ void VHACD::ComputeACD(const Parameters& params)
     m_overallProgress = 95.0;
     Update(100.0, 100.0, params);
     m_timer.Toc();
+    m_stats.m_acdTime = m_timer.GetElapsedTime();
     if (params.m_logger) {
         msg.str("");
         msg << "\t time " << m_timer.GetElapsedTime() / 1000.0 << "s" << std::endl;
@@ -1229,7 +1439,7 @@ void AddPoints(const Mesh* const mesh, SArray<Vec3<double> >& pts)
         pts.PushBack(mesh->GetPoint(i));
     }
 }
-void ComputeConvexHull(const Mesh* const ch1, const Mesh* const ch2, SArray<Vec3<double> >& pts, Mesh* const combinedCH)
+size_t ComputeConvexHull(const Mesh* const ch1, const Mesh* const ch2, SArray<Vec3<double> >& pts, Mesh* const combinedCH)
 {
     pts.Resize(0);
     AddPoints(ch1, pts);
@@ -1256,7 +1466,104 @@ void ComputeConvexHull(const Mesh* const ch1, const Mesh* const ch2, SArray<Vec3
             c = edge->getTargetVertex();
         }
     }
+    return pts.Size();
+}
+static double ComputeConeVolume(const Mesh* const ch, const double orientation, const Vec3<double>& apex)
+{
+    // volume swept when ch is extended to apex, i.e. the tetrahedra joining apex to the faces it sees
+    double volume = 0.0;
+    const size_t nT = ch->GetNTriangles();
+    for (size_t t = 0; t < nT; ++t) {
+        const Vec3<int>& tri = ch->GetTriangle(t);
+        const double v = orientation * ComputeVolume4(ch->GetPoint(tri[0]), ch->GetPoint(tri[1]), ch->GetPoint(tri[2]), apex);
+        if (v < 0.0) {
+            volume -= v;
+        }
+    }
+    return volume / 6.0;
+}
+struct MergeHullBounds {
+    MergeHullBounds(const Mesh* const ch, const int index)
+    {
+        m_mesh = ch;
+        m_index = index;
+        m_volume = ch->ComputeVolume();
+        m_orientation = (m_volume < 0.0) ? -1.0 : 1.0;
+        const size_t nV = ch->GetNPoints();
+        for (int k = 0; k < 3; ++k) {
+            m_minVertex[k] = m_maxVertex[k] = 0;
+        }
+        for (size_t v = 1; v < nV; ++v) {
+            const Vec3<double>& pt = ch->GetPoint(v);
+            for (int k = 0; k < 3; ++k) {
+                if (pt[k] < ch->GetPoint(m_minVertex[k])[k]) {
+                    m_minVertex[k] = v;
+                }
+                if (pt[k] > ch->GetPoint(m_maxVertex[k])[k]) {
+                    m_maxVertex[k] = v;
+                }
+            }
+        }
+    }
+    double GetMin(const int k) const { return m_mesh->GetPoint(m_minVertex[k])[k]; }
+    double GetMax(const int k) const { return m_mesh->GetPoint(m_maxVertex[k])[k]; }
+
+    const Mesh* m_mesh;
+    double m_volume;
+    double m_orientation;
+    size_t m_minVertex[3];
+    size_t m_maxVertex[3];
+    int m_index; // position in m_convexHulls, -1 once merged
+};
+static double ComputeCombinedVolumeLowerBound(const MergeHullBounds& below, const MergeHullBounds& above, const int k)
+{
+    // below lies under the plane x[k] = above.GetMin(k), and above over it. Their combined convex-hull
+    // contains both hulls plus, on either side of the plane, the cone joining the other hull's nearest vertex
+    // to the faces it sees.
+    return MAX(ComputeConeVolume(below.m_mesh, below.m_orientation, above.m_mesh->GetPoint(above.m_minVertex[k])),
+        ComputeConeVolume(above.m_mesh, above.m_orientation, below.m_mesh->GetPoint(below.m_maxVertex[k])));
+}
+static float ComputeMergeCostLowerBound(const MergeHullBounds& ch1, const MergeHullBounds& ch2, const double volume0)
+{
+    // Only hulls whose bounding boxes are separated get a non-trivial bound. It is shrunk to absorb the
+    // rounding of the exact cost, whose combined hull is quantized by btConvexHullComputer.
+    double bound = 0.0;
+    if (ch1.m_mesh->GetNTriangles() == 0 || ch2.m_mesh->GetNTriangles() == 0) {
+        return 0.0f;
+    }
+    for (int k = 0; k < 3; ++k) {
+        if (ch1.GetMax(k) <= ch2.GetMin(k)) {
+            bound = MAX(bound, ComputeCombinedVolumeLowerBound(ch1, ch2, k));
+        }
+        else if (ch2.GetMax(k) <= ch1.GetMin(k)) {
+            bound = MAX(bound, ComputeCombinedVolumeLowerBound(ch2, ch1, k));
+        }
+    }
+    bound = 0.99 * bound - 1.0e-3 * (fabs(ch1.m_volume) + fabs(ch2.m_volume));
+    return (bound > 0.0) ? (float)(bound / volume0) : 0.0f;
 }
+struct MergeHullCandidate {
+    MergeHullCandidate(const float cost, const bool exact, const int id1, const int id2)
+        : m_cost(cost)
+        , m_exact(exact)
+        , m_id1(id1)
+        , m_id2(id2)
+    {
+    }
+    // std::priority_queue pops the greatest element: the lowest cost first, lower bounds before exact
+    // costs so that every pair tied with an exact minimum has been evaluated when it is popped
+    bool operator<(const MergeHullCandidate& rhs) const
+    {
+        if (m_cost != rhs.m_cost) {
+            return m_cost > rhs.m_cost;
+        }
+        return m_exact && !rhs.m_exact;
+    }
+    float m_cost; // merge cost, or a lower bound of it when !m_exact
+    bool m_exact;
+    int m_id1; // m_id1 > m_id2
+    int m_id2;
+};
 void VHACD::MergeConvexHulls(const Parameters& params)
 {
     if (GetCancel()) {
@@ -1279,41 +1586,92 @@ void VHACD::MergeConvexHulls(const Parameters& params)
         SArray<Vec3<double> > pts;
         Mesh combinedCH;
 
-        // Populate the cost matrix
-        size_t idx = 0;
-        SArray<float> costMatrix;
-        costMatrix.Resize(((nConvexHulls * nConvexHulls) - nConvexHulls) >> 1);
-        for (size_t p1 = 1; p1 < nConvexHulls; ++p1) {
-            const float volume1 = m_convexHulls[p1]->ComputeVolume();
-            for (size_t p2 = 0; p2 < p1; ++p2) {
-                ComputeConvexHull(m_convexHulls[p1], m_convexHulls[p2], pts, &combinedCH);
-                costMatrix[idx++] = ComputeConcavity(volume1 + m_convexHulls[p2]->ComputeVolume(), combinedCH.ComputeVolume(), m_volumeCH0);
+        // Hulls are referred to by ids, which are never reused: merging two hulls retires their ids and
+        // gives the result a new, larger one
+        std::vector<MergeHullBounds> hulls;
+        std::vector<int> ids; // ids[p] is the id of m_convexHulls[p]
+        hulls.reserve(2 * nConvexHulls);
+        ids.reserve(nConvexHulls);
+        for (size_t p = 0; p < nConvexHulls; ++p) {
+            hulls.push_back(MergeHullBounds(m_convexHulls[p], (int)p));
+            ids.push_back((int)p);
+        }
+
+        // Queue every pair with a lower bound of its cost; the combined hull of a pair is only computed once
+        // its bound reaches the top of the queue
+        std::priority_queue<MergeHullCandidate> candidates;
+        for (int id1 = 1; id1 < (int)nConvexHulls; ++id1) {
+            for (int id2 = 0; id2 < id1; ++id2) {
+                candidates.push(MergeHullCandidate(ComputeMergeCostLowerBound(hulls[id1], hulls[id2], m_volumeCH0), false, id1, id2));
             }
         }
 
         // Until we cant merge below the maximum cost
-        size_t costSize = m_convexHulls.Size();
+        std::vector<MergeHullCandidate> ties;
         while (!m_cancel) {
             msg.str("");
             msg << "Iteration " << iteration++;
             m_operation = msg.str();
 
             // Search for lowest cost
-            float bestCost = (std::numeric_limits<float>::max)();
-            const size_t addr = FindMinimumElement(costMatrix.Data(), &bestCost, 0, costMatrix.Size());
+            bool found = false;
+            while (!candidates.empty() && !found && !m_cancel) {
+                MergeHullCandidate top = candidates.top();
+                if (top.m_cost >= threshold) {
+                    break;
+                }
+                candidates.pop();
+                if (hulls[top.m_id1].m_index < 0 || hulls[top.m_id2].m_index < 0) {
+                    continue;
+                }
+                if (top.m_exact) {
+                    ties.push_back(top);
+                    found = true;
+                }
+                else {
+                    const MergeHullBounds& ch1 = hulls[top.m_id1];
+                    const MergeHullBounds& ch2 = hulls[top.m_id2];
+                    AddConvexHullStats(1, ComputeConvexHull(ch1.m_mesh, ch2.m_mesh, pts, &combinedCH));
+                    const float volume1 = ch1.m_volume;
+                    top.m_cost = ComputeConcavity(volume1 + ch2.m_volume, combinedCH.ComputeVolume(), m_volumeCH0);
+                    top.m_exact = true;
+                    candidates.push(top);
+                }
+            }
 
             // Check if we should merge these hulls
-            if (bestCost >= threshold) {
+            if (!found) {
                 break;
             }
-
-            const size_t addrI = (static_cast<int>(sqrt(1 + (8 * addr))) - 1) >> 1;
-            const size_t p1 = addrI + 1;
-            const size_t p2 = addr - ((addrI * (addrI + 1)) >> 1);
-            assert(p1 >= 0);
-            assert(p2 >= 0);
-            assert(p1 < costSize);
-            assert(p2 < costSize);
+            ++m_stats.m_nMergeIterations;
+
+            // Among pairs of equal cost, merge the one a full scan of the cost matrix would have found first
+            const float bestCost = ties[0].m_cost;
+            while (!candidates.empty() && candidates.top().m_cost == bestCost) {
+                const MergeHullCandidate& top = candidates.top();
+                if (hulls[top.m_id1].m_index >= 0 && hulls[top.m_id2].m_index >= 0) {
+                    ties.push_back(top);
+                }
+                candidates.pop();
+            }
+            size_t p1 = 0;
+            size_t p2 = 0;
+            size_t best = 0;
+            for (size_t t = 0; t < ties.size(); ++t) {
+                const size_t i1 = MAX(hulls[ties[t].m_id1].m_index, hulls[ties[t].m_id2].m_index);
+                const size_t i2 = MIN(hulls[ties[t].m_id1].m_index, hulls[ties[t].m_id2].m_index);
+                if (t == 0 || ((i1 * (i1 - 1)) >> 1) + i2 < ((p1 * (p1 - 1)) >> 1) + p2) {
+                    p1 = i1;
+                    p2 = i2;
+                    best = t;
+                }
+            }
+            for (size_t t = 0; t < ties.size(); ++t) {
+                if (t != best) {
+                    candidates.push(ties[t]);
+                }
+            }
+            ties.clear();
 
             if (params.m_logger) {
                 msg.str("");
@@ -1322,61 +1680,39 @@ void VHACD::MergeConvexHulls(const Parameters& params)
                 params.m_logger->Log(msg.str().c_str());
             }
 
-            // Make the lowest cost row and column into a new hull
+            // Make the lowest cost pair into a new hull
             Mesh* cch = new Mesh;
-            ComputeConvexHull(m_convexHulls[p1], m_convexHulls[p2], pts, cch);
+            AddConvexHullStats(1, ComputeConvexHull(m_convexHulls[p1], m_convexHulls[p2], pts, cch));
             delete m_convexHulls[p2];
             m_convexHulls[p2] = cch;
+            hulls[ids[p2]].m_index = -1;
 
             delete m_convexHulls[p1];
-            std::swap(m_convexHulls[p1], m_convexHulls[m_convexHulls.Size() - 1]);
+            hulls[ids[p1]].m_index = -1;
+            const size_t last = m_convexHulls.Size() - 1;
+            std::swap(m_convexHulls[p1], m_convexHulls[last]);
             m_convexHulls.PopBack();
-
-            costSize = costSize - 1;
-
-            // Calculate costs versus the new hull
-            size_t rowIdx = ((p2 - 1) * p2) >> 1;
-            const float volume1 = m_convexHulls[p2]->ComputeVolume();
-            for (size_t i = 0; (i < p2) && (!m_cancel); ++i) {
-                ComputeConvexHull(m_convexHulls[p2], m_convexHulls[i], pts, &combinedCH);
-                costMatrix[rowIdx++] = ComputeConcavity(volume1 + m_convexHulls[i]->ComputeVolume(), combinedCH.ComputeVolume(), m_volumeCH0);
-            }
-
-            rowIdx += p2;
-            for (size_t i = p2 + 1; (i < costSize) && (!m_cancel); ++i) {
-                ComputeConvexHull(m_convexHulls[p2], m_convexHulls[i], pts, &combinedCH);
-                costMatrix[rowIdx] = ComputeConcavity(volume1 + m_convexHulls[i]->ComputeVolume(), combinedCH.ComputeVolume(), m_volumeCH0);
-                rowIdx += i;
-                assert(rowIdx >= 0);
+            if (p1 != last) {
+                ids[p1] = ids[last];
+                hulls[ids[p1]].m_index = (int)p1;
             }
-
-            // Move the top column in to replace its space
-            const size_t erase_idx = ((costSize - 1) * costSize) >> 1;
-            if (p1 < costSize) {
-                rowIdx = (addrI * p1) >> 1;
-                size_t top_row = erase_idx;
-                for (size_t i = 0; i < p1; ++i) {
-                    if (i != p2) {
-                        costMatrix[rowIdx] = costMatrix[top_row];
-                    }
-                    ++rowIdx;
-                    ++top_row;
-                }
-
-                ++top_row;
-                rowIdx += p1;
-                for (size_t i = p1 + 1; i < (costSize + 1); ++i) {
-                    costMatrix[rowIdx] = costMatrix[top_row++];
-                    rowIdx += i;
-                    assert(rowIdx >= 0);
+            ids.pop_back();
+
+            // Queue the new hull against the others
+            const int id1 = (int)hulls.size();
+            hulls.push_back(MergeHullBounds(cch, (int)p2));
+            ids[p2] = id1;
+            for (size_t i = 0; i < ids.size(); ++i) {
+                if (i != p2) {
+                    candidates.push(MergeHullCandidate(ComputeMergeCostLowerBound(hulls[id1], hulls[ids[i]], m_volumeCH0), false, id1, ids[i]));
                 }
             }
-            costMatrix.Resize(erase_idx);
         }
     }
     m_overallProgress = 99.0;
     Update(100.0, 100.0, params);
     m_timer.Toc();
+    m_stats.m_mergeTime = m_timer.GetElapsedTime();
     if (params.m_logger) {
         msg.str("");
         msg << "\t time " << m_timer.GetElapsedTime() / 1000.0 << "s" << std::endl;
@@ -1428,6 +1764,7 @@ void VHACD::SimplifyConvexHulls(const Parameters& params)
     m_overallProgress = 100.0;
     Update(100.0, 100.0, params);
     m_timer.Toc();
+    m_stats.m_simplifyTime = m_timer.GetElapsedTime();
     if (params.m_logger) {
         msg.str("");
         msg << "\t time " << m_timer.GetElapsedTime() / 1000.0 << "s" << std::endl;
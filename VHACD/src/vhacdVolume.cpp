@@ -18,9 +18,25 @@
 #include <algorithm>
 #include <float.h>
 #include <math.h>
-#include <queue>
 #include <string.h>
 
+#ifndef USE_AVX2
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define USE_AVX2 1
+#else
+#define USE_AVX2 0
+#endif
+#endif
+#if USE_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
 #ifdef _MSC_VER
 #pragma warning(disable:4100 4458)
 #endif
@@ -256,6 +272,237 @@ int TriBoxOverlap(const Vec3<double>& boxcenter,
     return 1; /* box and triangle overlaps */
 }
 
+//! Overlaps of the triangle with the unit boxes centred on the voxels (i, j, k), k0 <= k < k1 <= k0 + 64, one bit per voxel.
+typedef uint64_t (*TriBoxOverlapRowFunction)(const Vec3<double> (&p)[3], const size_t i, const size_t j, const size_t k0, const size_t k1);
+
+uint64_t TriBoxOverlapRow(const Vec3<double> (&p)[3], const size_t i, const size_t j, const size_t k0, const size_t k1)
+{
+    Vec3<double> boxcenter((double)i, (double)j, 0.0);
+    const Vec3<double> boxhalfsize(0.5, 0.5, 0.5);
+    uint64_t overlaps = 0;
+    for (size_t k = k0; k < k1; ++k) {
+        boxcenter[2] = (double)k;
+        if (TriBoxOverlap(boxcenter, boxhalfsize, p[0], p[1], p[2])) {
+            overlaps |= (uint64_t)1 << (k - k0);
+        }
+    }
+    return overlaps;
+}
+#if USE_AVX2
+//! Lanes where the projections [min(x, y), max(x, y)] of the triangle on a separating axis miss [-rad, rad].
+AVX2_TARGET inline __m256d AxisTestFails(const __m256d x, const __m256d y, const __m256d rad)
+{
+    // as in the AXISTEST macros: if (x < y) { min = x; max = y; } else { min = y; max = x; }
+    const __m256d min = _mm256_min_pd(x, y);
+    const __m256d max = _mm256_max_pd(y, x);
+    const __m256d minusRad = _mm256_xor_pd(rad, _mm256_set1_pd(-0.0));
+    return _mm256_or_pd(_mm256_cmp_pd(min, rad, _CMP_GT_OQ), _mm256_cmp_pd(max, minusRad, _CMP_LT_OQ));
+}
+//! TriBoxOverlapRow on four voxels at a time. Every test does the very same floating-point operations as TriBoxOverlap,
+//! so that the classification is identical; as only z changes along the row, the tests on x and y alone are done once.
+AVX2_TARGET uint64_t TriBoxOverlapRowAVX2(const Vec3<double> (&p)[3], const size_t i, const size_t j, const size_t k0, const size_t k1)
+{
+    const Vec3<double> boxhalfsize(0.5, 0.5, 0.5);
+    const Vec3<double> v0(p[0][X] - (double)i, p[0][Y] - (double)j, 0.0);
+    const Vec3<double> v1(p[1][X] - (double)i, p[1][Y] - (double)j, 0.0);
+    const Vec3<double> v2(p[2][X] - (double)i, p[2][Y] - (double)j, 0.0);
+    const Vec3<double> e0(v1[X] - v0[X], v1[Y] - v0[Y], 0.0);
+    const Vec3<double> e1(v2[X] - v1[X], v2[Y] - v1[Y], 0.0);
+    const Vec3<double> e2(v0[X] - v2[X], v0[Y] - v2[Y], 0.0);
+    double min, max, p0, p1, p2, rad, fex, fey;
+    fex = fabs(e0[X]);
+    fey = fabs(e0[Y]);
+    AXISTEST_Z12(e0[Y], e0[X], fey, fex);
+    fex = fabs(e1[X]);
+    fey = fabs(e1[Y]);
+    AXISTEST_Z0(e1[Y], e1[X], fey, fex);
+    fex = fabs(e2[X]);
+    fey = fabs(e2[Y]);
+    AXISTEST_Z12(e2[Y], e2[X], fey, fex);
+    FINDMINMAX(v0[X], v1[X], v2[X], min, max);
+    if (min > boxhalfsize[X] || max < -boxhalfsize[X])
+        return 0;
+    FINDMINMAX(v0[Y], v1[Y], v2[Y], min, max);
+    if (min > boxhalfsize[Y] || max < -boxhalfsize[Y])
+        return 0;
+
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d minusHalf = _mm256_set1_pd(-0.5);
+    const __m256d signMask = _mm256_set1_pd(-0.0);
+    const __m256d v0x = _mm256_set1_pd(v0[X]), v0y = _mm256_set1_pd(v0[Y]);
+    const __m256d v1x = _mm256_set1_pd(v1[X]), v1y = _mm256_set1_pd(v1[Y]);
+    const __m256d v2x = _mm256_set1_pd(v2[X]), v2y = _mm256_set1_pd(v2[Y]);
+    const __m256d e0x = _mm256_set1_pd(e0[X]), e0y = _mm256_set1_pd(e0[Y]);
+    const __m256d e1x = _mm256_set1_pd(e1[X]), e1y = _mm256_set1_pd(e1[Y]);
+    const __m256d e2x = _mm256_set1_pd(e2[X]), e2y = _mm256_set1_pd(e2[Y]);
+    // halves of |e[X]| and |e[Y]|, the lane-invariant terms of rad
+    const __m256d rx0 = _mm256_set1_pd(fabs(e0[X]) * boxhalfsize[Z]), ry0 = _mm256_set1_pd(fabs(e0[Y]) * boxhalfsize[Z]);
+    const __m256d rx1 = _mm256_set1_pd(fabs(e1[X]) * boxhalfsize[Z]), ry1 = _mm256_set1_pd(fabs(e1[Y]) * boxhalfsize[Z]);
+    const __m256d rx2 = _mm256_set1_pd(fabs(e2[X]) * boxhalfsize[Z]), ry2 = _mm256_set1_pd(fabs(e2[Y]) * boxhalfsize[Z]);
+    // normal = e0 ^ e1: its z component is lane-invariant, and so are the x and y components of vmin and vmax
+    const double nz = e0[X] * e1[Y] - e0[Y] * e1[X];
+    const __m256d nzv = _mm256_set1_pd(nz);
+    const __m256d lowX = _mm256_set1_pd(-boxhalfsize[X] - v0[X]), highX = _mm256_set1_pd(boxhalfsize[X] - v0[X]);
+    const __m256d lowY = _mm256_set1_pd(-boxhalfsize[Y] - v0[Y]), highY = _mm256_set1_pd(boxhalfsize[Y] - v0[Y]);
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d p0z = _mm256_set1_pd(p[0][Z]);
+    const __m256d p1z = _mm256_set1_pd(p[1][Z]);
+    const __m256d p2z = _mm256_set1_pd(p[2][Z]);
+    uint64_t overlaps = 0;
+    for (size_t k = k0; k < k1; k += 4) {
+        const __m256d c = _mm256_set_pd((double)(k + 3), (double)(k + 2), (double)(k + 1), (double)k);
+        const __m256d v0z = _mm256_sub_pd(p0z, c);
+        const __m256d v1z = _mm256_sub_pd(p1z, c);
+        const __m256d v2z = _mm256_sub_pd(p2z, c);
+        const __m256d e0z = _mm256_sub_pd(v1z, v0z);
+        const __m256d e1z = _mm256_sub_pd(v2z, v1z);
+        const __m256d e2z = _mm256_sub_pd(v0z, v2z);
+
+        // AXISTEST_X01 and AXISTEST_Y02 on e0
+        __m256d fez = _mm256_mul_pd(_mm256_andnot_pd(signMask, e0z), half);
+        __m256d a = e0z;
+        __m256d minusA = _mm256_xor_pd(a, signMask);
+        __m256d fails = AxisTestFails(_mm256_sub_pd(_mm256_mul_pd(a, v0y), _mm256_mul_pd(e0y, v0z)),
+            _mm256_sub_pd(_mm256_mul_pd(a, v2y), _mm256_mul_pd(e0y, v2z)), _mm256_add_pd(fez, ry0));
+        fails = _mm256_or_pd(fails, AxisTestFails(_mm256_add_pd(_mm256_mul_pd(minusA, v0x), _mm256_mul_pd(e0x, v0z)),
+            _mm256_add_pd(_mm256_mul_pd(minusA, v2x), _mm256_mul_pd(e0x, v2z)), _mm256_add_pd(fez, rx0)));
+        // AXISTEST_X01 and AXISTEST_Y02 on e1
+        fez = _mm256_mul_pd(_mm256_andnot_pd(signMask, e1z), half);
+        a = e1z;
+        minusA = _mm256_xor_pd(a, signMask);
+        fails = _mm256_or_pd(fails, AxisTestFails(_mm256_sub_pd(_mm256_mul_pd(a, v0y), _mm256_mul_pd(e1y, v0z)),
+            _mm256_sub_pd(_mm256_mul_pd(a, v2y), _mm256_mul_pd(e1y, v2z)), _mm256_add_pd(fez, ry1)));
+        fails = _mm256_or_pd(fails, AxisTestFails(_mm256_add_pd(_mm256_mul_pd(minusA, v0x), _mm256_mul_pd(e1x, v0z)),
+            _mm256_add_pd(_mm256_mul_pd(minusA, v2x), _mm256_mul_pd(e1x, v2z)), _mm256_add_pd(fez, rx1)));
+        // AXISTEST_X2 and AXISTEST_Y1 on e2
+        fez = _mm256_mul_pd(_mm256_andnot_pd(signMask, e2z), half);
+        a = e2z;
+        minusA = _mm256_xor_pd(a, signMask);
+        fails = _mm256_or_pd(fails, AxisTestFails(_mm256_sub_pd(_mm256_mul_pd(a, v0y), _mm256_mul_pd(e2y, v0z)),
+            _mm256_sub_pd(_mm256_mul_pd(a, v1y), _mm256_mul_pd(e2y, v1z)), _mm256_add_pd(fez, ry2)));
+        fails = _mm256_or_pd(fails, AxisTestFails(_mm256_add_pd(_mm256_mul_pd(minusA, v0x), _mm256_mul_pd(e2x, v0z)),
+            _mm256_add_pd(_mm256_mul_pd(minusA, v1x), _mm256_mul_pd(e2x, v1z)), _mm256_add_pd(fez, rx2)));
+
+        // FINDMINMAX in the z direction
+        __m256d minz = _mm256_min_pd(v1z, v0z);
+        __m256d maxz = _mm256_max_pd(v1z, v0z);
+        minz = _mm256_min_pd(v2z, minz);
+        maxz = _mm256_max_pd(v2z, maxz);
+        fails = _mm256_or_pd(fails, _mm256_or_pd(_mm256_cmp_pd(minz, half, _CMP_GT_OQ), _mm256_cmp_pd(maxz, minusHalf, _CMP_LT_OQ)));
+
+        // PlaneBoxOverlap
+        const __m256d nx = _mm256_sub_pd(_mm256_mul_pd(e0y, e1z), _mm256_mul_pd(e0z, e1y));
+        const __m256d ny = _mm256_sub_pd(_mm256_mul_pd(e0z, e1x), _mm256_mul_pd(e0x, e1z));
+        const __m256d nxPos = _mm256_cmp_pd(nx, zero, _CMP_GT_OQ);
+        const __m256d nyPos = _mm256_cmp_pd(ny, zero, _CMP_GT_OQ);
+        const __m256d vminx = _mm256_blendv_pd(highX, lowX, nxPos);
+        const __m256d vmaxx = _mm256_blendv_pd(lowX, highX, nxPos);
+        const __m256d vminy = _mm256_blendv_pd(highY, lowY, nyPos);
+        const __m256d vmaxy = _mm256_blendv_pd(lowY, highY, nyPos);
+        const __m256d vminz = (nz > 0.0) ? _mm256_sub_pd(minusHalf, v0z) : _mm256_sub_pd(half, v0z);
+        const __m256d vmaxz = (nz > 0.0) ? _mm256_sub_pd(half, v0z) : _mm256_sub_pd(minusHalf, v0z);
+        const __m256d dmin = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(nx, vminx), _mm256_mul_pd(ny, vminy)), _mm256_mul_pd(nzv, vminz));
+        const __m256d dmax = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(nx, vmaxx), _mm256_mul_pd(ny, vmaxy)), _mm256_mul_pd(nzv, vmaxz));
+        fails = _mm256_or_pd(fails, _mm256_or_pd(_mm256_cmp_pd(dmin, zero, _CMP_GT_OQ), _mm256_cmp_pd(dmax, zero, _CMP_NGE_UQ)));
+
+        const uint64_t lanes = (k1 - k < 4) ? ((uint64_t)1 << (k1 - k)) - 1 : 0xF;
+        overlaps |= (~(uint64_t)_mm256_movemask_pd(fails) & lanes) << (k - k0);
+    }
+    return overlaps;
+}
+bool CPUSupportsAVX2()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    // AVX with the YMM registers saved by the OS, then AVX2
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+#endif // USE_AVX2
+TriBoxOverlapRowFunction SelectTriBoxOverlapRow()
+{
+#if USE_AVX2
+    if (CPUSupportsAVX2()) {
+        return TriBoxOverlapRowAVX2;
+    }
+#endif
+    return TriBoxOverlapRow;
+}
+//! Sides of the voxels coords[0, n) against the axis-aligned plane between the voxel layers index and index + 1,
+//! one bit per voxel: in positive for the voxels above index, in nearPlane for the voxels of the two layers.
+typedef void (*ClassifyVoxelsFunction)(const short* const coords, const size_t n, const short index, uint64_t* const positive, uint64_t* const nearPlane);
+
+void ClassifyVoxels(const short* const coords, const size_t n, const short index, uint64_t* const positive, uint64_t* const nearPlane)
+{
+    for (size_t w = 0; w < (n + 63) / 64; ++w) {
+        positive[w] = nearPlane[w] = 0;
+    }
+    for (size_t v = 0; v < n; ++v) {
+        const int offset = coords[v] - index;
+        positive[v / 64] |= (uint64_t)(offset > 0) << (v % 64);
+        nearPlane[v / 64] |= (uint64_t)(offset == 0 || offset == 1) << (v % 64);
+    }
+}
+#if USE_AVX2
+AVX2_TARGET void ClassifyVoxelsAVX2(const short* const coords, const size_t n, const short index, uint64_t* const positive, uint64_t* const nearPlane)
+{
+    // 32 voxels per step: the 16-bit lane masks of two vectors are packed to bytes, whose sign bits are gathered.
+    const __m256i vindex = _mm256_set1_epi16(index);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi16(1);
+    size_t v = 0;
+    for (; v + 32 <= n; v += 32) {
+        const __m256i d0 = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*)(coords + v)), vindex);
+        const __m256i d1 = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*)(coords + v + 16)), vindex);
+        const __m256i p = _mm256_packs_epi16(_mm256_cmpgt_epi16(d0, zero), _mm256_cmpgt_epi16(d1, zero));
+        const __m256i q = _mm256_packs_epi16(_mm256_or_si256(_mm256_cmpeq_epi16(d0, zero), _mm256_cmpeq_epi16(d0, one)),
+            _mm256_or_si256(_mm256_cmpeq_epi16(d1, zero), _mm256_cmpeq_epi16(d1, one)));
+        // packs works within the 128-bit halves: the middle quadwords are swapped back into voxel order
+        const uint64_t pm = (uint32_t)_mm256_movemask_epi8(_mm256_permute4x64_epi64(p, 0xD8));
+        const uint64_t qm = (uint32_t)_mm256_movemask_epi8(_mm256_permute4x64_epi64(q, 0xD8));
+        if (v % 64 == 0) {
+            positive[v / 64] = pm;
+            nearPlane[v / 64] = qm;
+        }
+        else {
+            positive[v / 64] |= pm << 32;
+            nearPlane[v / 64] |= qm << 32;
+        }
+    }
+    if (v < n) {
+        if (v % 64 == 0) {
+            positive[v / 64] = nearPlane[v / 64] = 0;
+        }
+        for (; v < n; ++v) {
+            const int offset = coords[v] - index;
+            positive[v / 64] |= (uint64_t)(offset > 0) << (v % 64);
+            nearPlane[v / 64] |= (uint64_t)(offset == 0 || offset == 1) << (v % 64);
+        }
+    }
+}
+#endif // USE_AVX2
+ClassifyVoxelsFunction SelectClassifyVoxels()
+{
+#if USE_AVX2
+    if (CPUSupportsAVX2()) {
+        return ClassifyVoxelsAVX2;
+    }
+#endif
+    return ClassifyVoxels;
+}
+
 // Slightly modified version of  Stan Melax's code for 3x3 matrix diagonalization (Thanks Stan!)
 // source: http://www.melax.com/diag.html?attredirects=0
 void Diagonalize(const double (&A)[3][3], double (&Q)[3][3], double (&D)[3][3])
@@ -354,8 +601,183 @@ void Diagonalize(const double (&A)[3][3], double (&Q)[3][3], double (&D)[3][3])
     }
 }
 const double TetrahedronSet::EPS = 0.0000000000001;
+const uint64_t LOW_BITS = 0x5555555555555555ULL; // low bit of every 2-bit voxel of a word
+// PRIMITIVE_INSIDE_SURFACE and PRIMITIVE_ON_SURFACE are the values with the high bit set
+inline unsigned int SolidVoxels(const unsigned int row)
+{
+    return (row >> 1) & 0x5555u;
+}
+inline size_t PopCount(uint64_t x)
+{
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (size_t)((x * 0x0101010101010101ULL) >> 56);
+}
+inline bool IsAxisAligned(const Plane& plane)
+{
+    return (plane.m_axis == AXIS_X && plane.m_a == 1.0 && plane.m_b == 0.0 && plane.m_c == 0.0)
+        || (plane.m_axis == AXIS_Y && plane.m_a == 0.0 && plane.m_b == 1.0 && plane.m_c == 0.0)
+        || (plane.m_axis == AXIS_Z && plane.m_a == 0.0 && plane.m_b == 0.0 && plane.m_c == 1.0);
+}
+size_t VoxelGrid::SumBox(const SArray<unsigned int>& table, const Vec3<short>& minVoxel,
+    const Vec3<short>& maxVoxel) const
+{
+    if (minVoxel[0] > maxVoxel[0] || minVoxel[1] > maxVoxel[1] || minVoxel[2] > maxVoxel[2])
+        return 0;
+    const size_t nk = (size_t)m_dim[2] + 1;
+    const size_t njk = ((size_t)m_dim[1] + 1) * nk;
+    const size_t i0 = minVoxel[0] * njk;
+    const size_t i1 = (maxVoxel[0] + 1) * njk;
+    const size_t j0 = minVoxel[1] * nk;
+    const size_t j1 = (maxVoxel[1] + 1) * nk;
+    const size_t k0 = minVoxel[2];
+    const size_t k1 = maxVoxel[2] + 1;
+    const unsigned int* const data = table.Data();
+    return (size_t)data[i1 + j1 + k1] - data[i0 + j1 + k1] - data[i1 + j0 + k1] - data[i1 + j1 + k0]
+        + data[i0 + j0 + k1] + data[i0 + j1 + k0] + data[i1 + j0 + k0] - data[i0 + j0 + k0];
+}
+inline bool VoxelBeforeLayer(const Voxel& voxel, const short k)
+{
+    return voxel.m_coord[2] < k;
+}
+VoxelSet::Iterator::Iterator(const VoxelSet& vset, const bool surfaceOnly)
+    : m_vset(vset)
+    , m_surfaceOnly(surfaceOnly || vset.m_surfaceOnly)
+    , m_voxel(0)
+    , m_columnEnd(0)
+    , m_first(0)
+    , m_last(0)
+    , m_kLast(vset.m_maxWindow[2])
+    , m_i(vset.m_minWindow[0])
+    , m_j(vset.m_minWindow[1] - 1)
+    , m_code(VoxelGrid::GetMortonCode(vset.m_minWindow[0], vset.m_minWindow[1]) - 1)
+    , m_maxCode(VoxelGrid::GetMortonCode(vset.m_maxWindow[0], vset.m_maxWindow[1]))
+    , m_columnOnSurface(false)
+{
+    if (!vset.m_grid || vset.m_minWindow[0] > vset.m_maxWindow[0] || vset.m_minWindow[1] > vset.m_maxWindow[1]
+        || vset.m_minWindow[2] > vset.m_maxWindow[2]) {
+        m_i = vset.m_maxWindow[0];
+        m_j = vset.m_maxWindow[1];
+        m_code = m_maxCode;
+    }
+}
+bool VoxelSet::Iterator::NextColumn()
+{
+    const Vec3<short>& minWindow = m_vset.m_minWindow;
+    const Vec3<short>& maxWindow = m_vset.m_maxWindow;
+    const VoxelGrid& grid = *m_vset.m_grid;
+    for (;;) {
+        if (grid.IsMortonOrdered()) {
+            if (!NextMortonColumn()) {
+                return false;
+            }
+        }
+        else if (++m_j > maxWindow[1]) {
+            m_j = minWindow[1];
+            if (++m_i > maxWindow[0]) {
+                return false;
+            }
+        }
+        const Voxel* const begin = grid.GetColumnBegin(m_i, m_j);
+        const Voxel* const end = grid.GetColumnEnd(m_i, m_j);
+        if (begin == end) {
+            continue;
+        }
+        m_columnOnSurface = (m_i == minWindow[0] && m_vset.IsFaceOnSurface(0, 0))
+            || (m_i == maxWindow[0] && m_vset.IsFaceOnSurface(0, 1))
+            || (m_j == minWindow[1] && m_vset.IsFaceOnSurface(1, 0))
+            || (m_j == maxWindow[1] && m_vset.IsFaceOnSurface(1, 1));
+        const short k0 = minWindow[2];
+        const short k1 = maxWindow[2];
+        if (!m_surfaceOnly || m_columnOnSurface) {
+            m_voxel = std::lower_bound(begin, end, k0, VoxelBeforeLayer);
+            m_columnEnd = end;
+            m_kLast = k1;
+            return true;
+        }
+        // Surface voxels of the set: the voxels of the clipped faces along k, and the surface voxels of
+        // the grid in between.
+        const bool minFace = m_vset.IsFaceOnSurface(2, 0);
+        const bool maxFace = m_vset.IsFaceOnSurface(2, 1) && (k1 != k0 || !minFace);
+        if (minFace) {
+            const Voxel* const first = std::lower_bound(begin, end, k0, VoxelBeforeLayer);
+            m_first = (first < end && first->m_coord[2] == k0) ? first : 0;
+        }
+        if (maxFace) {
+            const Voxel* const last = std::lower_bound(begin, end, k1, VoxelBeforeLayer);
+            m_last = (last < end && last->m_coord[2] == k1) ? last : 0;
+        }
+        const Voxel* const surfaceEnd = grid.GetSurfaceColumnEnd(m_i, m_j);
+        m_voxel = std::lower_bound(grid.GetSurfaceColumnBegin(m_i, m_j), surfaceEnd, (short)(k0 + minFace), VoxelBeforeLayer);
+        m_columnEnd = surfaceEnd;
+        m_kLast = k1 - maxFace;
+        return true;
+    }
+}
+inline short CompactBits(size_t x)
+{
+    x &= 0x55555555;
+    x = (x | (x >> 1)) & 0x33333333;
+    x = (x | (x >> 2)) & 0x0F0F0F0F;
+    x = (x | (x >> 4)) & 0x00FF00FF;
+    x = (x | (x >> 8)) & 0x0000FFFF;
+    return (short)x;
+}
+bool VoxelSet::Iterator::NextMortonColumn()
+{
+    // Steps to the next Morton code, then jumps over the codes out of the window with the BIGMIN search of
+    // Tropf and Herzog: the bits of the code, from the highest, either leave the code in the window or
+    // narrow the range [minCode, maxCode] of the codes of the window to one half.
+    const Vec3<short>& minWindow = m_vset.m_minWindow;
+    const Vec3<short>& maxWindow = m_vset.m_maxWindow;
+    if (m_code == m_maxCode) {
+        return false;
+    }
+    size_t code = m_code + 1;
+    short i = CompactBits(code >> 1);
+    short j = CompactBits(code);
+    if (i < minWindow[0] || i > maxWindow[0] || j < minWindow[1] || j > maxWindow[1]) {
+        size_t minCode = VoxelGrid::GetMortonCode(minWindow[0], minWindow[1]);
+        size_t maxCode = m_maxCode;
+        size_t bigMin = maxCode;
+        for (int b = 31; b >= 0; --b) {
+            const size_t bit = (size_t)1 << b;
+            // the bits of the same coordinate below b
+            const size_t lowerBits = ((b & 1) ? 0xAAAAAAAA : 0x55555555) & (bit - 1);
+            const int bits = (int)(((code & bit) != 0) << 2 | ((minCode & bit) != 0) << 1 | ((maxCode & bit) != 0));
+            if (bits == 1) { // 0 0 1
+                bigMin = (minCode & ~lowerBits) | bit;
+                maxCode = (maxCode | lowerBits) & ~bit;
+            }
+            else if (bits == 3) { // 0 1 1
+                bigMin = minCode;
+                break;
+            }
+            else if (bits == 4) { // 1 0 0
+                break;
+            }
+            else if (bits == 5) { // 1 0 1
+                minCode = (minCode & ~lowerBits) | bit;
+            }
+        }
+        code = bigMin;
+        i = CompactBits(code >> 1);
+        j = CompactBits(code);
+    }
+    m_code = code;
+    m_i = i;
+    m_j = j;
+    return true;
+}
 VoxelSet::VoxelSet()
 {
+    m_minWindow[0] = m_minWindow[1] = m_minWindow[2] = 0;
+    m_maxWindow[0] = m_maxWindow[1] = m_maxWindow[2] = -1;
+    m_surfaceFaces = 0;
+    m_surfaceOnly = false;
+    m_counted = true;
+    m_hasMoments = false;
     m_minBB[0] = m_minBB[1] = m_minBB[2] = 0.0;
     m_minBBVoxels[0] = m_minBBVoxels[1] = m_minBBVoxels[2] = 0;
     m_maxBBVoxels[0] = m_maxBBVoxels[1] = m_maxBBVoxels[2] = 1;
@@ -373,55 +795,211 @@ VoxelSet::VoxelSet()
 VoxelSet::~VoxelSet(void)
 {
 }
-void VoxelSet::ComputeBB()
+void VoxelSet::CountVoxels() const
 {
-    const size_t nVoxels = m_voxels.Size();
-    if (nVoxels == 0)
+    if (m_grid && m_grid->HasSummedVolumeTables()) {
+        // The voxels which are not on a flagged face lie in the window shrunk by one layer on these faces,
+        // and are on the surface iff they were in the grid.
+        Vec3<short> minInner;
+        Vec3<short> maxInner;
+        for (int h = 0; h < 3; ++h) {
+            minInner[h] = m_minWindow[h] + IsFaceOnSurface(h, 0);
+            maxInner[h] = m_maxWindow[h] - IsFaceOnSurface(h, 1);
+        }
+        const size_t nVoxels = m_grid->CountVoxels(m_minWindow, m_maxWindow);
+        const size_t nInsideSurface = m_grid->CountVoxels(minInner, maxInner) - m_grid->CountVoxelsOnSurface(minInner, maxInner);
+        m_numVoxelsOnSurface = nVoxels - nInsideSurface;
+        m_numVoxelsInsideSurface = m_surfaceOnly ? 0 : nInsideSurface;
+        m_counted = true;
         return;
+    }
+    size_t nOnSurface = 0;
+    size_t nInsideSurface = 0;
+    Iterator it(*this);
+    Voxel voxel;
+    while (it.Next(voxel)) {
+        if (voxel.m_data == PRIMITIVE_ON_SURFACE) {
+            ++nOnSurface;
+        }
+        else {
+            ++nInsideSurface;
+        }
+    }
+    m_numVoxelsOnSurface = nOnSurface;
+    m_numVoxelsInsideSurface = nInsideSurface;
+    m_counted = true;
+}
+void VoxelSet::GetVoxels(SArray<Voxel, 8>& voxels) const
+{
+    voxels.Resize(0);
+    voxels.Allocate(GetNPrimitives());
+    Iterator it(*this);
+    Voxel voxel;
+    while (it.Next(voxel)) {
+        voxels.PushBack(voxel);
+    }
+}
+void VoxelSet::ComputeSurfaceCoordinates()
+{
+    const size_t nVoxels = GetNPrimitivesOnSurf();
+    std::shared_ptr<VoxelCoordinates> coordinates(new VoxelCoordinates);
+    for (int h = 0; h < 3; ++h) {
+        coordinates->m_coord[h].Resize(nVoxels);
+    }
+    short* const x = coordinates->m_coord[0].Data();
+    short* const y = coordinates->m_coord[1].Data();
+    short* const z = coordinates->m_coord[2].Data();
+    Iterator it(*this, true);
+    Voxel voxel;
+    size_t v = 0;
+    while (it.Next(voxel)) {
+        x[v] = voxel.m_coord[0];
+        y[v] = voxel.m_coord[1];
+        z[v] = voxel.m_coord[2];
+        ++v;
+    }
+    assert(v == nVoxels);
+    m_surfaceCoordinates = coordinates;
+}
+//! Rank of the voxel v of coordinates in the storage order of grid.
+inline uint64_t GetStorageRank(const VoxelGrid& grid, const VoxelCoordinates& coordinates, const size_t v)
+{
+    return ((uint64_t)grid.GetColumn(coordinates.m_coord[0][v], coordinates.m_coord[1][v]) << 16)
+        | (unsigned short)coordinates.m_coord[2][v];
+}
+void VoxelSet::ClipSurfaceCoordinates(VoxelSet& part, const int axis, const int side, const bool newFace) const
+{
+    // The surface voxels of a part are the surface voxels of the set on its side and, when the clip made the layer
+    // along the plane a face of the part, the voxels of that layer. Both lists are in storage order: they are merged.
+    const VoxelCoordinates& parent = *m_surfaceCoordinates;
+    const size_t nParent = parent.Size();
+    const short* const parentLayers = parent.m_coord[axis].Data();
+    const short minLayer = part.m_minWindow[axis];
+    const short maxLayer = part.m_maxWindow[axis];
+    VoxelCoordinates face;
+    if (newFace && minLayer <= maxLayer) {
+        VoxelSet layer;
+        layer.m_grid = m_grid;
+        layer.m_minWindow = part.m_minWindow;
+        layer.m_maxWindow = part.m_maxWindow;
+        layer.m_minWindow[axis] = layer.m_maxWindow[axis] = side ? maxLayer : minLayer;
+        Iterator it(layer);
+        Voxel voxel;
+        while (it.Next(voxel)) {
+            for (int h = 0; h < 3; ++h) {
+                face.m_coord[h].PushBack(voxel.m_coord[h]);
+            }
+        }
+    }
+    const size_t nFace = face.Size();
+    if (nFace == 0) {
+        size_t nInside = 0;
+        for (size_t p = 0; p < nParent; ++p) {
+            nInside += (parentLayers[p] >= minLayer && parentLayers[p] <= maxLayer);
+        }
+        if (nInside == nParent) {
+            part.m_surfaceCoordinates = m_surfaceCoordinates;
+            return;
+        }
+    }
+    std::shared_ptr<VoxelCoordinates> coordinates(new VoxelCoordinates);
     for (int h = 0; h < 3; ++h) {
-        m_minBBVoxels[h] = m_voxels[0].m_coord[h];
-        m_maxBBVoxels[h] = m_voxels[0].m_coord[h];
+        coordinates->m_coord[h].Resize(nParent + nFace);
     }
-    Vec3<double> bary(0.0);
-    for (size_t p = 0; p < nVoxels; ++p) {
+    const VoxelGrid& grid = *m_grid;
+    size_t n = 0;
+    size_t p = 0;
+    size_t f = 0;
+    while (p < nParent || f < nFace) {
+        if (p < nParent && (parentLayers[p] < minLayer || parentLayers[p] > maxLayer)) {
+            ++p;
+            continue;
+        }
+        const VoxelCoordinates* source = &parent;
+        size_t v = p;
+        if (p == nParent) {
+            source = &face;
+            v = f++;
+        }
+        else if (f < nFace) {
+            const uint64_t parentRank = GetStorageRank(grid, parent, p);
+            const uint64_t faceRank = GetStorageRank(grid, face, f);
+            if (faceRank < parentRank) {
+                source = &face;
+                v = f++;
+            }
+            else {
+                f += (faceRank == parentRank);
+                ++p;
+            }
+        }
+        else {
+            ++p;
+        }
         for (int h = 0; h < 3; ++h) {
-            bary[h] += m_voxels[p].m_coord[h];
-            if (m_minBBVoxels[h] > m_voxels[p].m_coord[h])
-                m_minBBVoxels[h] = m_voxels[p].m_coord[h];
-            if (m_maxBBVoxels[h] < m_voxels[p].m_coord[h])
-                m_maxBBVoxels[h] = m_voxels[p].m_coord[h];
+            coordinates->m_coord[h][n] = source->m_coord[h][v];
         }
+        ++n;
+    }
+    for (int h = 0; h < 3; ++h) {
+        coordinates->m_coord[h].Resize(n);
+    }
+    part.m_surfaceCoordinates = coordinates;
+}
+void VoxelSet::ComputeMoments()
+{
+    m_moments.Reset();
+    Iterator it(*this);
+    Voxel voxel;
+    while (it.Next(voxel)) {
+        m_moments.Add(voxel, voxel.m_data == PRIMITIVE_ON_SURFACE);
+    }
+    m_hasMoments = true;
+}
+void VoxelSet::ComputeBB()
+{
+    if (!m_hasMoments) {
+        ComputeMoments();
     }
-    bary /= (double)nVoxels;
+    const size_t nVoxels = m_moments.m_nVoxels;
+    if (nVoxels == 0)
+        return;
+    m_numVoxelsOnSurface = m_moments.m_nVoxelsOnSurface;
+    m_numVoxelsInsideSurface = nVoxels - m_moments.m_nVoxelsOnSurface;
+    m_counted = true;
     for (int h = 0; h < 3; ++h) {
+        m_minBBVoxels[h] = m_moments.m_min[h];
+        m_maxBBVoxels[h] = m_moments.m_max[h];
         m_minBBPts[h] = m_minBBVoxels[h] * m_scale + m_minBB[h];
         m_maxBBPts[h] = m_maxBBVoxels[h] * m_scale + m_minBB[h];
-        m_barycenter[h] = (short)(bary[h] + 0.5);
+        m_barycenter[h] = (short)((double)m_moments.m_sum[h] / (double)nVoxels + 0.5);
     }
 }
-void VoxelSet::ComputeConvexHull(Mesh& meshCH, const size_t sampling) const
+size_t VoxelSet::ComputeConvexHull(Mesh& meshCH, const size_t sampling) const
 {
     const size_t CLUSTER_SIZE = 65536;
-    const size_t nVoxels = m_voxels.Size();
-    if (nVoxels == 0)
-        return;
+    if (GetNPrimitives() == 0)
+        return 0;
+    Iterator it(*this, true);
+    Voxel voxel;
+    bool more = it.Next(voxel);
 
     SArray<Vec3<double> > cpoints;
 
     Vec3<double>* points = new Vec3<double>[CLUSTER_SIZE];
-    size_t p = 0;
+    size_t nPoints = 0;
     size_t s = 0;
     short i, j, k;
-    while (p < nVoxels) {
+    do {
         size_t q = 0;
-        while (q < CLUSTER_SIZE && p < nVoxels) {
-            if (m_voxels[p].m_data == PRIMITIVE_ON_SURFACE) {
+        while (q < CLUSTER_SIZE && more) {
+            if (voxel.m_data == PRIMITIVE_ON_SURFACE) {
                 ++s;
                 if (s == sampling) {
                     s = 0;
-                    i = m_voxels[p].m_coord[0];
-                    j = m_voxels[p].m_coord[1];
-                    k = m_voxels[p].m_coord[2];
+                    i = voxel.m_coord[0];
+                    j = voxel.m_coord[1];
+                    k = voxel.m_coord[2];
                     Vec3<double> p0((i - 0.5) * m_scale, (j - 0.5) * m_scale, (k - 0.5) * m_scale);
                     Vec3<double> p1((i + 0.5) * m_scale, (j - 0.5) * m_scale, (k - 0.5) * m_scale);
                     Vec3<double> p2((i + 0.5) * m_scale, (j + 0.5) * m_scale, (k - 0.5) * m_scale);
@@ -440,19 +1018,21 @@ void VoxelSet::ComputeConvexHull(Mesh& meshCH, const size_t sampling) const
                     points[q++] = p7 + m_minBB;
                 }
             }
-            ++p;
+            more = it.Next(voxel);
         }
         btConvexHullComputer ch;
         ch.compute((double*)points, 3 * sizeof(double), (int)q, -1.0, -1.0);
+        nPoints += q;
         for (int v = 0; v < ch.vertices.size(); v++) {
             cpoints.PushBack(Vec3<double>(ch.vertices[v].getX(), ch.vertices[v].getY(), ch.vertices[v].getZ()));
         }
-    }
+    } while (more);
     delete[] points;
 
     points = cpoints.Data();
     btConvexHullComputer ch;
     ch.compute((double*)points, 3 * sizeof(double), (int)cpoints.Size(), -1.0, -1.0);
+    nPoints += cpoints.Size();
     meshCH.ResizePoints(0);
     meshCH.ResizeTriangles(0);
     for (int v = 0; v < ch.vertices.size(); v++) {
@@ -472,6 +1052,7 @@ void VoxelSet::ComputeConvexHull(Mesh& meshCH, const size_t sampling) const
             c = edge->getTargetVertex();
         }
     }
+    return nPoints;
 }
 void VoxelSet::GetPoints(const Voxel& voxel,
     Vec3<double>* const pts) const
@@ -509,57 +1090,88 @@ void VoxelSet::Intersect(const Plane& plane,
     SArray<Vec3<double> >* const negativePts,
     const size_t sampling) const
 {
-    const size_t nVoxels = m_voxels.Size();
-    if (nVoxels == 0)
-        return;
+    // An axis-aligned plane lies between the voxel layers m_index and m_index + 1: the voxels above m_index are
+    // on its positive side, and the voxels of these two layers are the ones within m_scale of the plane. They are
+    // classified from their integer coordinates.
+    const bool axisAligned = IsAxisAligned(plane);
     const double d0 = m_scale;
-    double d;
     Vec3<double> pts[8];
-    Vec3<double> pt;
     Voxel voxel;
     size_t sp = 0;
     size_t sn = 0;
-    for (size_t v = 0; v < nVoxels; ++v) {
-        voxel = m_voxels[v];
-        pt = GetPoint(voxel);
-        d = plane.m_a * pt[0] + plane.m_b * pt[1] + plane.m_c * pt[2] + plane.m_d;
-        //            if      (d >= 0.0 && d <= d0) positivePts->PushBack(pt);
-        //            else if (d < 0.0 && -d <= d0) negativePts->PushBack(pt);
-        if (d >= 0.0) {
-            if (d <= d0) {
-                GetPoints(voxel, pts);
-                for (int k = 0; k < 8; ++k) {
-                    positivePts->PushBack(pts[k]);
+    if (axisAligned && m_surfaceOnly && m_surfaceCoordinates) {
+        // Classifies the voxels by blocks of 4096 into bit masks. The blocks of 64 voxels without voxels near the
+        // plane, nor sampled voxel, only advance the sampling counters.
+        static const ClassifyVoxelsFunction classifyVoxels = SelectClassifyVoxels();
+        const size_t BLOCK_SIZE = 4096;
+        uint64_t positive[BLOCK_SIZE / 64];
+        uint64_t nearPlane[BLOCK_SIZE / 64];
+        const VoxelCoordinates& coordinates = *m_surfaceCoordinates;
+        const size_t nVoxels = coordinates.Size();
+        const short* const coords = coordinates.m_coord[plane.m_axis].Data();
+        voxel.m_data = PRIMITIVE_UNDEFINED;
+        for (size_t b = 0; b < nVoxels; b += BLOCK_SIZE) {
+            const size_t nBlockVoxels = std::min(BLOCK_SIZE, nVoxels - b);
+            classifyVoxels(coords + b, nBlockVoxels, plane.m_index, positive, nearPlane);
+            for (size_t w = 0; w < (nBlockVoxels + 63) / 64; ++w) {
+                const size_t v0 = b + 64 * w;
+                const uint64_t valid = (nVoxels - v0 < 64) ? ((uint64_t)1 << (nVoxels - v0)) - 1 : ~(uint64_t)0;
+                const size_t nPositive = PopCount(positive[w] & ~nearPlane[w]);
+                const size_t nNegative = PopCount(~positive[w] & ~nearPlane[w] & valid);
+                if (nearPlane[w] == 0 && sp + nPositive < sampling && sn + nNegative < sampling) {
+                    sp += nPositive;
+                    sn += nNegative;
+                    continue;
                 }
-            }
-            else {
-                if (++sp == sampling) {
-                    //                        positivePts->PushBack(pt);
+                for (size_t v = 0; v < 64 && ((valid >> v) & 1); ++v) {
+                    const bool positiveVoxel = ((positive[w] >> v) & 1) != 0;
+                    if (((nearPlane[w] >> v) & 1) == 0) {
+                        size_t& s = positiveVoxel ? sp : sn;
+                        if (++s != sampling) {
+                            continue;
+                        }
+                        s = 0;
+                    }
+                    for (int h = 0; h < 3; ++h) {
+                        voxel.m_coord[h] = coordinates.m_coord[h][v0 + v];
+                    }
+                    SArray<Vec3<double> >* const sidePts = positiveVoxel ? positivePts : negativePts;
                     GetPoints(voxel, pts);
                     for (int k = 0; k < 8; ++k) {
-                        positivePts->PushBack(pts[k]);
+                        sidePts->PushBack(pts[k]);
                     }
-                    sp = 0;
                 }
             }
         }
+        return;
+    }
+    Iterator it(*this);
+    while (it.Next(voxel)) {
+        bool positive;
+        bool nearPlane;
+        if (axisAligned) {
+            const int offset = voxel.m_coord[plane.m_axis] - plane.m_index;
+            positive = (offset > 0);
+            nearPlane = (offset == 0 || offset == 1);
+        }
         else {
-            if (-d <= d0) {
-                GetPoints(voxel, pts);
-                for (int k = 0; k < 8; ++k) {
-                    negativePts->PushBack(pts[k]);
-                }
-            }
-            else {
-                if (++sn == sampling) {
-                    //                        negativePts->PushBack(pt);
-                    GetPoints(voxel, pts);
-                    for (int k = 0; k < 8; ++k) {
-                        negativePts->PushBack(pts[k]);
-                    }
-                    sn = 0;
-                }
+            const Vec3<double> pt = GetPoint(voxel);
+            const double d = plane.m_a * pt[0] + plane.m_b * pt[1] + plane.m_c * pt[2] + plane.m_d;
+            positive = (d >= 0.0);
+            nearPlane = (fabs(d) <= d0);
+        }
+        // The voxels away from the plane are sampled on each side.
+        if (!nearPlane) {
+            size_t& s = positive ? sp : sn;
+            if (++s != sampling) {
+                continue;
             }
+            s = 0;
+        }
+        SArray<Vec3<double> >* const sidePts = positive ? positivePts : negativePts;
+        GetPoints(voxel, pts);
+        for (int k = 0; k < 8; ++k) {
+            sidePts->PushBack(pts[k]);
         }
     }
 }
@@ -567,23 +1179,28 @@ void VoxelSet::ComputeExteriorPoints(const Plane& plane,
     const Mesh& mesh,
     SArray<Vec3<double> >* const exteriorPts) const
 {
-    const size_t nVoxels = m_voxels.Size();
-    if (nVoxels == 0)
-        return;
-    double d;
+    const bool axisAligned = IsAxisAligned(plane);
     Vec3<double> pt;
     Vec3<double> pts[8];
     Voxel voxel;
-    for (size_t v = 0; v < nVoxels; ++v) {
-        voxel = m_voxels[v];
-        pt = GetPoint(voxel);
-        d = plane.m_a * pt[0] + plane.m_b * pt[1] + plane.m_c * pt[2] + plane.m_d;
-        if (d >= 0.0) {
-            if (!mesh.IsInside(pt)) {
-                GetPoints(voxel, pts);
-                for (int k = 0; k < 8; ++k) {
-                    exteriorPts->PushBack(pts[k]);
-                }
+    Iterator it(*this);
+    while (it.Next(voxel)) {
+        if (axisAligned) {
+            if (voxel.m_coord[plane.m_axis] <= plane.m_index) {
+                continue;
+            }
+            pt = GetPoint(voxel);
+        }
+        else {
+            pt = GetPoint(voxel);
+            if (plane.m_a * pt[0] + plane.m_b * pt[1] + plane.m_c * pt[2] + plane.m_d < 0.0) {
+                continue;
+            }
+        }
+        if (!mesh.IsInside(pt)) {
+            GetPoints(voxel, pts);
+            for (int k = 0; k < 8; ++k) {
+                exteriorPts->PushBack(pts[k]);
             }
         }
     }
@@ -594,108 +1211,217 @@ void VoxelSet::ComputeClippedVolumes(const Plane& plane,
 {
     negativeVolume = 0.0;
     positiveVolume = 0.0;
-    const size_t nVoxels = m_voxels.Size();
-    if (nVoxels == 0)
+    if (m_grid && m_grid->HasSummedVolumeTables() && !m_surfaceOnly && IsAxisAligned(plane)) {
+        Vec3<short> minPositive = m_minWindow;
+        minPositive[plane.m_axis] = std::max<short>(m_minWindow[plane.m_axis], plane.m_index + 1);
+        const size_t nPositiveVoxels = m_grid->CountVoxels(minPositive, m_maxWindow);
+        positiveVolume = m_unitVolume * nPositiveVoxels;
+        negativeVolume = m_unitVolume * (GetNPrimitives() - nPositiveVoxels);
         return;
-    double d;
-    Vec3<double> pt;
+    }
+    const bool axisAligned = IsAxisAligned(plane);
+    Voxel voxel;
+    size_t nVoxels = 0;
     size_t nPositiveVoxels = 0;
-    for (size_t v = 0; v < nVoxels; ++v) {
-        pt = GetPoint(m_voxels[v]);
-        d = plane.m_a * pt[0] + plane.m_b * pt[1] + plane.m_c * pt[2] + plane.m_d;
-        nPositiveVoxels += (d >= 0.0);
+    Iterator it(*this);
+    while (it.Next(voxel)) {
+        if (axisAligned) {
+            nPositiveVoxels += (voxel.m_coord[plane.m_axis] > plane.m_index);
+        }
+        else {
+            const Vec3<double> pt = GetPoint(voxel);
+            nPositiveVoxels += (plane.m_a * pt[0] + plane.m_b * pt[1] + plane.m_c * pt[2] + plane.m_d >= 0.0);
+        }
+        ++nVoxels;
     }
     size_t nNegativeVoxels = nVoxels - nPositiveVoxels;
     positiveVolume = m_unitVolume * nPositiveVoxels;
     negativeVolume = m_unitVolume * nNegativeVoxels;
 }
+void VoxelSet::ComputeClippedVolumes(const SArray<Plane>& planes,
+    SArray<double>& positiveVolumes,
+    SArray<double>& negativeVolumes) const
+{
+    // Axis-aligned planes sit between voxel layers m_index and m_index + 1, so a voxel lies on the
+    // positive side iff its coordinate along the plane axis is greater than m_index. The summed-volume
+    // tables count the voxels of the positive side in O(1), otherwise one pass builds per-axis occupancy
+    // histograms and a suffix sum then answers every plane in O(1).
+    const size_t nPlanes = planes.Size();
+    positiveVolumes.Resize(nPlanes);
+    negativeVolumes.Resize(nPlanes);
+    if (m_grid && m_grid->HasSummedVolumeTables() && !m_surfaceOnly) {
+        for (size_t p = 0; p < nPlanes; ++p) {
+            ComputeClippedVolumes(planes[p], positiveVolumes[p], negativeVolumes[p]);
+        }
+        return;
+    }
+    const size_t nVoxels = GetNPrimitives();
+    if (nVoxels == 0) {
+        for (size_t p = 0; p < nPlanes; ++p) {
+            positiveVolumes[p] = negativeVolumes[p] = 0.0;
+        }
+        return;
+    }
+    size_t* histograms[3];
+    for (int h = 0; h < 3; ++h) {
+        const size_t n = (size_t)(m_maxBBVoxels[h] - m_minBBVoxels[h] + 1);
+        histograms[h] = new size_t[n];
+        memset(histograms[h], 0, sizeof(size_t) * n);
+    }
+    Voxel voxel;
+    Iterator it(*this);
+    while (it.Next(voxel)) {
+        for (int h = 0; h < 3; ++h) {
+            assert(voxel.m_coord[h] >= m_minBBVoxels[h] && voxel.m_coord[h] <= m_maxBBVoxels[h]);
+            ++histograms[h][voxel.m_coord[h] - m_minBBVoxels[h]];
+        }
+    }
+    // histograms[h][i] <- number of voxels with coordinate >= m_minBBVoxels[h] + i
+    for (int h = 0; h < 3; ++h) {
+        for (short i = m_maxBBVoxels[h] - m_minBBVoxels[h]; i > 0; --i) {
+            histograms[h][i - 1] += histograms[h][i];
+        }
+    }
+    for (size_t p = 0; p < nPlanes; ++p) {
+        const Plane& plane = planes[p];
+        const int h = plane.m_axis;
+        if (!IsAxisAligned(plane)) {
+            ComputeClippedVolumes(plane, positiveVolumes[p], negativeVolumes[p]);
+            continue;
+        }
+        size_t nPositiveVoxels;
+        if (plane.m_index < m_minBBVoxels[h]) {
+            nPositiveVoxels = nVoxels;
+        }
+        else if (plane.m_index >= m_maxBBVoxels[h]) {
+            nPositiveVoxels = 0;
+        }
+        else {
+            nPositiveVoxels = histograms[h][plane.m_index + 1 - m_minBBVoxels[h]];
+        }
+        size_t nNegativeVoxels = nVoxels - nPositiveVoxels;
+        positiveVolumes[p] = m_unitVolume * nPositiveVoxels;
+        negativeVolumes[p] = m_unitVolume * nNegativeVoxels;
+    }
+    for (int h = 0; h < 3; ++h) {
+        delete[] histograms[h];
+    }
+}
 void VoxelSet::SelectOnSurface(PrimitiveSet* const onSurfP) const
 {
     VoxelSet* const onSurf = (VoxelSet*)onSurfP;
-    const size_t nVoxels = m_voxels.Size();
-    if (nVoxels == 0)
-        return;
-
     for (int h = 0; h < 3; ++h) {
         onSurf->m_minBB[h] = m_minBB[h];
     }
-    onSurf->m_voxels.Resize(0);
+    onSurf->m_grid = m_grid;
+    onSurf->m_minWindow = m_minWindow;
+    onSurf->m_maxWindow = m_maxWindow;
+    onSurf->m_surfaceFaces = m_surfaceFaces;
+    onSurf->m_surfaceOnly = true;
     onSurf->m_scale = m_scale;
     onSurf->m_unitVolume = m_unitVolume;
-    onSurf->m_numVoxelsOnSurface = 0;
+    onSurf->m_numVoxelsOnSurface = GetNPrimitivesOnSurf();
     onSurf->m_numVoxelsInsideSurface = 0;
-    Voxel voxel;
-    for (size_t v = 0; v < nVoxels; ++v) {
-        voxel = m_voxels[v];
-        if (voxel.m_data == PRIMITIVE_ON_SURFACE) {
-            onSurf->m_voxels.PushBack(voxel);
-            ++onSurf->m_numVoxelsOnSurface;
-        }
-    }
+    onSurf->m_counted = true;
+    onSurf->m_surfaceCoordinates = m_surfaceCoordinates;
+    onSurf->m_hasMoments = false;
 }
 void VoxelSet::Clip(const Plane& plane,
     PrimitiveSet* const positivePartP,
     PrimitiveSet* const negativePartP) const
 {
+    // The plane lies between the voxel layers m_index and m_index + 1 along its axis. The positive part
+    // keeps the layers above m_index and the negative part the others, and the voxels of the two layers
+    // along the plane become surface voxels of their part.
     VoxelSet* const positivePart = (VoxelSet*)positivePartP;
     VoxelSet* const negativePart = (VoxelSet*)negativePartP;
-    const size_t nVoxels = m_voxels.Size();
-    if (nVoxels == 0)
-        return;
+    const int h = plane.m_axis;
+    assert(IsAxisAligned(plane));
 
-    for (int h = 0; h < 3; ++h) {
-        negativePart->m_minBB[h] = positivePart->m_minBB[h] = m_minBB[h];
+    for (int a = 0; a < 3; ++a) {
+        negativePart->m_minBB[a] = positivePart->m_minBB[a] = m_minBB[a];
     }
-    positivePart->m_voxels.Resize(0);
-    negativePart->m_voxels.Resize(0);
-    positivePart->m_voxels.Allocate(nVoxels);
-    negativePart->m_voxels.Allocate(nVoxels);
+    negativePart->m_grid = positivePart->m_grid = m_grid;
+    negativePart->m_minWindow = m_minWindow;
+    negativePart->m_maxWindow = m_maxWindow;
+    positivePart->m_minWindow = m_minWindow;
+    positivePart->m_maxWindow = m_maxWindow;
+    negativePart->m_surfaceFaces = positivePart->m_surfaceFaces = m_surfaceFaces;
+    negativePart->m_surfaceOnly = positivePart->m_surfaceOnly = m_surfaceOnly;
     negativePart->m_scale = positivePart->m_scale = m_scale;
     negativePart->m_unitVolume = positivePart->m_unitVolume = m_unitVolume;
-    negativePart->m_numVoxelsOnSurface = positivePart->m_numVoxelsOnSurface = 0;
-    negativePart->m_numVoxelsInsideSurface = positivePart->m_numVoxelsInsideSurface = 0;
+    negativePart->m_counted = positivePart->m_counted = false;
 
-    double d;
-    Vec3<double> pt;
-    Voxel voxel;
-    const double d0 = m_scale;
-    for (size_t v = 0; v < nVoxels; ++v) {
-        voxel = m_voxels[v];
-        pt = GetPoint(voxel);
-        d = plane.m_a * pt[0] + plane.m_b * pt[1] + plane.m_c * pt[2] + plane.m_d;
-        if (d >= 0.0) {
-            if (voxel.m_data == PRIMITIVE_ON_SURFACE || d <= d0) {
-                voxel.m_data = PRIMITIVE_ON_SURFACE;
-                positivePart->m_voxels.PushBack(voxel);
-                ++positivePart->m_numVoxelsOnSurface;
+    // A set made of surface voxels only keeps its voxels: a face flag which no longer describes the
+    // layer on that face of the window is dropped instead of being set.
+    const short index = plane.m_index;
+    const unsigned char minFace = (unsigned char)(1 << (2 * h));
+    const unsigned char maxFace = (unsigned char)(1 << (2 * h + 1));
+    if (index + 1 >= m_minWindow[h]) {
+        if (m_surfaceOnly) {
+            if (index + 1 > m_minWindow[h]) {
+                positivePart->m_surfaceFaces &= (unsigned char)~minFace;
             }
-            else {
-                positivePart->m_voxels.PushBack(voxel);
-                ++positivePart->m_numVoxelsInsideSurface;
+        }
+        else {
+            positivePart->m_surfaceFaces |= minFace;
+        }
+        positivePart->m_minWindow[h] = index + 1;
+    }
+    if (index <= m_maxWindow[h]) {
+        if (m_surfaceOnly) {
+            if (index < m_maxWindow[h]) {
+                negativePart->m_surfaceFaces &= (unsigned char)~maxFace;
             }
         }
         else {
-            if (voxel.m_data == PRIMITIVE_ON_SURFACE || -d <= d0) {
-                voxel.m_data = PRIMITIVE_ON_SURFACE;
-                negativePart->m_voxels.PushBack(voxel);
-                ++negativePart->m_numVoxelsOnSurface;
+            negativePart->m_surfaceFaces |= maxFace;
+        }
+        negativePart->m_maxWindow[h] = index;
+    }
+
+    negativePart->m_surfaceCoordinates.reset();
+    positivePart->m_surfaceCoordinates.reset();
+    if (m_surfaceCoordinates && !m_surfaceOnly) {
+        ClipSurfaceCoordinates(*positivePart, h, 0, index + 1 >= m_minWindow[h]);
+        ClipSurfaceCoordinates(*negativePart, h, 1, index <= m_maxWindow[h]);
+    }
+
+    negativePart->m_hasMoments = positivePart->m_hasMoments = false;
+    if (m_hasMoments && !m_surfaceOnly) {
+        // The voxels of the set are on the surface of their part, or on the layer along the plane, which
+        // becomes a face of the part.
+        const short positiveFace = (index + 1 >= m_minWindow[h]) ? index + 1 : SHRT_MIN;
+        const short negativeFace = (index <= m_maxWindow[h]) ? index : SHRT_MIN;
+        VoxelMoments& positiveMoments = positivePart->m_moments;
+        VoxelMoments& negativeMoments = negativePart->m_moments;
+        positiveMoments.Reset();
+        negativeMoments.Reset();
+        Iterator it(*this);
+        Voxel voxel;
+        while (it.Next(voxel)) {
+            const short layer = voxel.m_coord[h];
+            if (layer > index) {
+                positiveMoments.Add(voxel, voxel.m_data == PRIMITIVE_ON_SURFACE || layer == positiveFace);
             }
             else {
-                negativePart->m_voxels.PushBack(voxel);
-                ++negativePart->m_numVoxelsInsideSurface;
+                negativeMoments.Add(voxel, voxel.m_data == PRIMITIVE_ON_SURFACE || layer == negativeFace);
             }
         }
+        positivePart->m_hasMoments = negativePart->m_hasMoments = true;
+        positivePart->m_numVoxelsOnSurface = positiveMoments.m_nVoxelsOnSurface;
+        positivePart->m_numVoxelsInsideSurface = positiveMoments.m_nVoxels - positiveMoments.m_nVoxelsOnSurface;
+        negativePart->m_numVoxelsOnSurface = negativeMoments.m_nVoxelsOnSurface;
+        negativePart->m_numVoxelsInsideSurface = negativeMoments.m_nVoxels - negativeMoments.m_nVoxelsOnSurface;
+        positivePart->m_counted = negativePart->m_counted = true;
     }
 }
 void VoxelSet::Convert(Mesh& mesh, const VOXEL_VALUE value) const
 {
-    const size_t nVoxels = m_voxels.Size();
-    if (nVoxels == 0)
-        return;
     Voxel voxel;
     Vec3<double> pts[8];
-    for (size_t v = 0; v < nVoxels; ++v) {
-        voxel = m_voxels[v];
+    Iterator it(*this, value == PRIMITIVE_ON_SURFACE);
+    while (it.Next(voxel)) {
         if (voxel.m_data == value) {
             GetPoints(voxel, pts);
             int s = (int)mesh.GetNPoints();
@@ -719,34 +1445,31 @@ void VoxelSet::Convert(Mesh& mesh, const VOXEL_VALUE value) const
 }
 void VoxelSet::ComputePrincipalAxes()
 {
-    const size_t nVoxels = m_voxels.Size();
+    if (!m_hasMoments) {
+        ComputeMoments();
+    }
+    const size_t nVoxels = m_moments.m_nVoxels;
     if (nVoxels == 0)
         return;
-    m_barycenterPCA[0] = m_barycenterPCA[1] = m_barycenterPCA[2] = 0.0;
-    for (size_t v = 0; v < nVoxels; ++v) {
-        Voxel& voxel = m_voxels[v];
-        m_barycenterPCA[0] += voxel.m_coord[0];
-        m_barycenterPCA[1] += voxel.m_coord[1];
-        m_barycenterPCA[2] += voxel.m_coord[2];
+    for (int h = 0; h < 3; ++h) {
+        m_barycenterPCA[h] = (double)m_moments.m_sum[h] / (double)nVoxels;
     }
-    m_barycenterPCA /= (double)nVoxels;
 
-    double covMat[3][3] = { { 0.0, 0.0, 0.0 },
-        { 0.0, 0.0, 0.0 },
-        { 0.0, 0.0, 0.0 } };
-    double x, y, z;
-    for (size_t v = 0; v < nVoxels; ++v) {
-        Voxel& voxel = m_voxels[v];
-        x = voxel.m_coord[0] - m_barycenter[0];
-        y = voxel.m_coord[1] - m_barycenter[1];
-        z = voxel.m_coord[2] - m_barycenter[2];
-        covMat[0][0] += x * x;
-        covMat[1][1] += y * y;
-        covMat[2][2] += z * z;
-        covMat[0][1] += x * y;
-        covMat[0][2] += x * z;
-        covMat[1][2] += y * z;
-    }
+    // Covariance around m_barycenter, from the moments: sum((x - bx) * (y - by))
+    // = sum(x * y) - bx * sum(y) - by * sum(x) + n * bx * by, exact in integers.
+    const int64_t n = (int64_t)nVoxels;
+    const int64_t bx = m_barycenter[0];
+    const int64_t by = m_barycenter[1];
+    const int64_t bz = m_barycenter[2];
+    const int64_t* const sum = m_moments.m_sum;
+    const int64_t* const sum2 = m_moments.m_sum2;
+    double covMat[3][3];
+    covMat[0][0] = (double)(sum2[0] - 2 * bx * sum[0] + n * bx * bx);
+    covMat[1][1] = (double)(sum2[1] - 2 * by * sum[1] + n * by * by);
+    covMat[2][2] = (double)(sum2[2] - 2 * bz * sum[2] + n * bz * bz);
+    covMat[0][1] = (double)(sum2[3] - bx * sum[1] - by * sum[0] + n * bx * by);
+    covMat[0][2] = (double)(sum2[4] - bx * sum[2] - bz * sum[0] + n * bx * bz);
+    covMat[1][2] = (double)(sum2[5] - by * sum[2] - bz * sum[1] + n * by * bz);
     covMat[0][0] /= nVoxels;
     covMat[1][1] /= nVoxels;
     covMat[2][2] /= nVoxels;
@@ -758,6 +1481,8 @@ void VoxelSet::ComputePrincipalAxes()
     covMat[2][1] = covMat[1][2];
     Diagonalize(covMat, m_Q, m_D);
 }
+const size_t Volume::BRICK_SIZE;
+const size_t Volume::BRICK_WORDS;
 Volume::Volume()
 {
     m_dim[0] = m_dim[1] = m_dim[2] = 0;
@@ -767,90 +1492,267 @@ Volume::Volume()
     m_numVoxelsInsideSurface = 0;
     m_numVoxelsOutsideSurface = 0;
     m_scale = 1.0;
-    m_data = 0;
+    m_brickDim[0] = m_brickDim[1] = m_brickDim[2] = 0;
+    m_numBricks = 0;
+    m_bricks = 0;
+    m_brickValues = 0;
 }
 Volume::~Volume(void)
 {
-    delete[] m_data;
+    Free();
 }
 void Volume::Allocate()
 {
-    delete[] m_data;
-    size_t size = m_dim[0] * m_dim[1] * m_dim[2];
-    m_data = new unsigned char[size];
-    memset(m_data, PRIMITIVE_UNDEFINED, sizeof(unsigned char) * size);
+    Free();
+    for (int h = 0; h < 3; ++h) {
+        m_brickDim[h] = (m_dim[h] + BRICK_SIZE - 1) / BRICK_SIZE;
+    }
+    m_numBricks = m_brickDim[0] * m_brickDim[1] * m_brickDim[2];
+    m_bricks = new uint64_t*[m_numBricks];
+    m_brickValues = new unsigned char[m_numBricks];
+    memset(m_bricks, 0, sizeof(uint64_t*) * m_numBricks);
+    memset(m_brickValues, PRIMITIVE_UNDEFINED, sizeof(unsigned char) * m_numBricks);
 }
 void Volume::Free()
 {
-    delete[] m_data;
-    m_data = 0;
+    for (size_t b = 0; b < m_numBricks; ++b) {
+        delete[] m_bricks[b];
+    }
+    delete[] m_bricks;
+    delete[] m_brickValues;
+    m_bricks = 0;
+    m_brickValues = 0;
+    m_numBricks = 0;
+}
+void Volume::GetBrickOrigin(const size_t brick, size_t& i, size_t& j, size_t& k) const
+{
+    k = (brick % m_brickDim[2]) * BRICK_SIZE;
+    j = ((brick / m_brickDim[2]) % m_brickDim[1]) * BRICK_SIZE;
+    i = (brick / (m_brickDim[2] * m_brickDim[1])) * BRICK_SIZE;
+}
+size_t Volume::GetBrickNumVoxels(const size_t brick) const
+{
+    size_t i, j, k;
+    GetBrickOrigin(brick, i, j, k);
+    return std::min(BRICK_SIZE, m_dim[0] - i) * std::min(BRICK_SIZE, m_dim[1] - j) * std::min(BRICK_SIZE, m_dim[2] - k);
 }
-void Volume::FillOutsideSurface(const size_t i0,
+void Volume::MaterializeBrick(const size_t brick)
+{
+    uint64_t* const data = new uint64_t[BRICK_WORDS];
+    const uint64_t value = LOW_BITS * m_brickValues[brick];
+    for (size_t w = 0; w < BRICK_WORDS; ++w) {
+        data[w] = value;
+    }
+    size_t i0, j0, k0;
+    GetBrickOrigin(brick, i0, j0, k0);
+    if (i0 + BRICK_SIZE > m_dim[0] || j0 + BRICK_SIZE > m_dim[1] || k0 + BRICK_SIZE > m_dim[2]) {
+        for (size_t i = i0; i < i0 + BRICK_SIZE; ++i) {
+            for (size_t j = j0; j < j0 + BRICK_SIZE; ++j) {
+                for (size_t k = k0; k < k0 + BRICK_SIZE; ++k) {
+                    if (i >= m_dim[0] || j >= m_dim[1] || k >= m_dim[2]) {
+                        uint64_t& word = data[GetBrickWord(i, j)];
+                        const int shift = GetBrickShift(j, k);
+                        word = (word & ~((uint64_t)3 << shift)) | ((uint64_t)PRIMITIVE_OUTSIDE_SURFACE << shift);
+                    }
+                }
+            }
+        }
+    }
+    m_bricks[brick] = data;
+}
+void Volume::ComputeTriangleBB(const double* const coords, const size_t nPoints, const size_t (&triangle)[3], Vec3<double> (&p)[3],
+    size_t& i0, size_t& j0, size_t& k0, size_t& i1, size_t& j1, size_t& k1) const
+{
+    size_t i, j, k;
+    for (int c = 0; c < 3; ++c) {
+        p[c][0] = coords[triangle[c]];
+        p[c][1] = coords[nPoints + triangle[c]];
+        p[c][2] = coords[2 * nPoints + triangle[c]];
+        i = static_cast<size_t>(p[c][0] + 0.5);
+        j = static_cast<size_t>(p[c][1] + 0.5);
+        k = static_cast<size_t>(p[c][2] + 0.5);
+        assert(i < m_dim[0] && i >= 0 && j < m_dim[1] && j >= 0 && k < m_dim[2] && k >= 0);
+
+        if (c == 0) {
+            i0 = i1 = i;
+            j0 = j1 = j;
+            k0 = k1 = k;
+        }
+        else {
+            if (i < i0)
+                i0 = i;
+            if (j < j0)
+                j0 = j;
+            if (k < k0)
+                k0 = k;
+            if (i > i1)
+                i1 = i;
+            if (j > j1)
+                j1 = j;
+            if (k > k1)
+                k1 = k;
+        }
+    }
+    if (i0 > 0)
+        --i0;
+    if (j0 > 0)
+        --j0;
+    if (k0 > 0)
+        --k0;
+    if (i1 < m_dim[0])
+        ++i1;
+    if (j1 < m_dim[1])
+        ++j1;
+    if (k1 < m_dim[2])
+        ++k1;
+}
+size_t Volume::RasterizeTriangle(const Vec3<double> (&p)[3],
+    const size_t i0,
     const size_t j0,
     const size_t k0,
     const size_t i1,
     const size_t j1,
     const size_t k1)
 {
-    const short neighbours[6][3] = { { 1, 0, 0 },
-        { 0, 1, 0 },
-        { 0, 0, 1 },
-        { -1, 0, 0 },
-        { 0, -1, 0 },
-        { 0, 0, -1 } };
-    std::queue<Vec3<short> > fifo;
-    Vec3<short> current;
-    short a, b, c;
+    static const TriBoxOverlapRowFunction triBoxOverlapRow = SelectTriBoxOverlapRow();
+    size_t numVoxelsOnSurface = 0;
     for (size_t i = i0; i < i1; ++i) {
         for (size_t j = j0; j < j1; ++j) {
-            for (size_t k = k0; k < k1; ++k) {
-
-                if (GetVoxel(i, j, k) == PRIMITIVE_UNDEFINED) {
-                    current[0] = (short)i;
-                    current[1] = (short)j;
-                    current[2] = (short)k;
-                    fifo.push(current);
-                    GetVoxel(current[0], current[1], current[2]) = PRIMITIVE_OUTSIDE_SURFACE;
-                    ++m_numVoxelsOutsideSurface;
-                    while (fifo.size() > 0) {
-                        current = fifo.front();
-                        fifo.pop();
-                        for (int h = 0; h < 6; ++h) {
-                            a = current[0] + neighbours[h][0];
-                            b = current[1] + neighbours[h][1];
-                            c = current[2] + neighbours[h][2];
-                            if (a < 0 || a >= (int)m_dim[0] || b < 0 || b >= (int)m_dim[1] || c < 0 || c >= (int)m_dim[2]) {
-                                continue;
-                            }
-                            unsigned char& v = GetVoxel(a, b, c);
-                            if (v == PRIMITIVE_UNDEFINED) {
-                                v = PRIMITIVE_OUTSIDE_SURFACE;
-                                ++m_numVoxelsOutsideSurface;
-                                fifo.push(Vec3<short>(a, b, c));
-                            }
-                        }
+            for (size_t k = k0; k < k1; k += 64) {
+                uint64_t overlaps = triBoxOverlapRow(p, i, j, k, std::min(k1, k + 64));
+                for (size_t v = k; overlaps; ++v, overlaps >>= 1) {
+                    if ((overlaps & 1) && GetVoxel(i, j, v) == PRIMITIVE_UNDEFINED) {
+                        SetVoxel(i, j, v, PRIMITIVE_ON_SURFACE);
+                        ++numVoxelsOnSurface;
                     }
                 }
             }
         }
     }
+    return numVoxelsOnSurface;
 }
-void Volume::FillInsideSurface()
+void Volume::PushOutsideSeeds(const short i, const short j, const short k0, const short k1,
+    SArray<Vec3<short> >& seeds) const
 {
-    const size_t i0 = m_dim[0];
-    const size_t j0 = m_dim[1];
-    const size_t k0 = m_dim[2];
-    for (size_t i = 0; i < i0; ++i) {
-        for (size_t j = 0; j < j0; ++j) {
-            for (size_t k = 0; k < k0; ++k) {
-                unsigned char& v = GetVoxel(i, j, k);
-                if (v == PRIMITIVE_UNDEFINED) {
-                    v = PRIMITIVE_INSIDE_SURFACE;
-                    ++m_numVoxelsInsideSurface;
+    // one seed per run of undefined voxels of the row (i, j) in [k0, k1]
+    if (i < 0 || i >= (short)m_dim[0] || j < 0 || j >= (short)m_dim[1]) {
+        return;
+    }
+    bool inRun = false;
+    for (short k = k0; k <= k1; ++k) {
+        const bool undefined = GetVoxel(i, j, k) == PRIMITIVE_UNDEFINED;
+        if (undefined && !inRun) {
+            seeds.PushBack(Vec3<short>(i, j, k));
+        }
+        inRun = undefined;
+    }
+}
+void Volume::FillOutsideSurface()
+{
+    // Scanline fill from the boundary of the grid: a seed is grown into the span of undefined voxels of its
+    // row along k, and the rows around the span get one seed per run of undefined voxels. An undefined
+    // uniform brick holds no surface voxel, so it is marked outside at once and seeds the rows around it.
+    const short i0 = (short)m_dim[0];
+    const short j0 = (short)m_dim[1];
+    const short k0 = (short)m_dim[2];
+    SArray<Vec3<short> > seeds;
+    for (short i = 0; i < i0; ++i) {
+        for (short j = 0; j < j0; ++j) {
+            if (i == 0 || i == i0 - 1 || j == 0 || j == j0 - 1) {
+                PushOutsideSeeds(i, j, 0, k0 - 1, seeds);
+            }
+            else {
+                PushOutsideSeeds(i, j, 0, 0, seeds);
+                PushOutsideSeeds(i, j, k0 - 1, k0 - 1, seeds);
+            }
+        }
+    }
+    while (seeds.Size() > 0) {
+        const Vec3<short> seed = seeds[seeds.Size() - 1];
+        seeds.PopBack();
+        const short i = seed[0];
+        const short j = seed[1];
+        if (GetVoxel(i, j, seed[2]) != PRIMITIVE_UNDEFINED) {
+            continue;
+        }
+        const size_t brick = GetBrick(i, j, seed[2]);
+        if (!m_bricks[brick]) {
+            m_brickValues[brick] = PRIMITIVE_OUTSIDE_SURFACE;
+            m_numVoxelsOutsideSurface += GetBrickNumVoxels(brick);
+            size_t bi, bj, bk;
+            GetBrickOrigin(brick, bi, bj, bk);
+            const short bi1 = (short)std::min(bi + BRICK_SIZE, m_dim[0]) - 1;
+            const short bj1 = (short)std::min(bj + BRICK_SIZE, m_dim[1]) - 1;
+            const short bk1 = (short)std::min(bk + BRICK_SIZE, m_dim[2]) - 1;
+            for (short a = (short)bi; a <= bi1; ++a) {
+                PushOutsideSeeds(a, (short)bj - 1, (short)bk, bk1, seeds);
+                PushOutsideSeeds(a, bj1 + 1, (short)bk, bk1, seeds);
+                for (short b = (short)bj; b <= bj1; ++b) {
+                    if (bk > 0) {
+                        PushOutsideSeeds(a, b, (short)bk - 1, (short)bk - 1, seeds);
+                    }
+                    if (bk1 + 1 < k0) {
+                        PushOutsideSeeds(a, b, bk1 + 1, bk1 + 1, seeds);
+                    }
                 }
             }
+            for (short b = (short)bj; b <= bj1; ++b) {
+                PushOutsideSeeds((short)bi - 1, b, (short)bk, bk1, seeds);
+                PushOutsideSeeds(bi1 + 1, b, (short)bk, bk1, seeds);
+            }
+            continue;
+        }
+        // grow the span within materialized bricks, an undefined uniform brick ending it gets a seed
+        short kl = seed[2];
+        short kr = seed[2];
+        while (kl > 0 && GetVoxel(i, j, kl - 1) == PRIMITIVE_UNDEFINED) {
+            if (!m_bricks[GetBrick(i, j, kl - 1)]) {
+                seeds.PushBack(Vec3<short>(i, j, kl - 1));
+                break;
+            }
+            --kl;
+        }
+        while (kr < k0 - 1 && GetVoxel(i, j, kr + 1) == PRIMITIVE_UNDEFINED) {
+            if (!m_bricks[GetBrick(i, j, kr + 1)]) {
+                seeds.PushBack(Vec3<short>(i, j, kr + 1));
+                break;
+            }
+            ++kr;
+        }
+        for (short k = kl; k <= kr; ++k) {
+            SetVoxel(i, j, k, PRIMITIVE_OUTSIDE_SURFACE);
+        }
+        m_numVoxelsOutsideSurface += kr - kl + 1;
+        PushOutsideSeeds(i - 1, j, kl, kr, seeds);
+        PushOutsideSeeds(i + 1, j, kl, kr, seeds);
+        PushOutsideSeeds(i, j - 1, kl, kr, seeds);
+        PushOutsideSeeds(i, j + 1, kl, kr, seeds);
+    }
+}
+void Volume::FillInsideSurface()
+{
+    // Word-level: the undefined voxels are the 2-bit fields with both bits cleared.
+    size_t numVoxelsInsideSurface = 0;
+#if _OPENMP
+#pragma omp parallel for reduction(+ : numVoxelsInsideSurface)
+#endif
+    for (long long b = 0; b < (long long)m_numBricks; ++b) {
+        const size_t brick = (size_t)b;
+        uint64_t* const data = m_bricks[brick];
+        if (!data) {
+            if (m_brickValues[brick] == PRIMITIVE_UNDEFINED) {
+                m_brickValues[brick] = PRIMITIVE_INSIDE_SURFACE;
+                numVoxelsInsideSurface += GetBrickNumVoxels(brick);
+            }
+            continue;
+        }
+        for (size_t w = 0; w < BRICK_WORDS; ++w) {
+            const uint64_t undefined = ~(data[w] | (data[w] >> 1)) & LOW_BITS;
+            data[w] |= undefined << 1;
+            numVoxelsInsideSurface += PopCount(undefined);
         }
     }
+    m_numVoxelsInsideSurface += numVoxelsInsideSurface;
 }
 void Volume::Convert(Mesh& mesh, const VOXEL_VALUE value) const
 {
@@ -860,7 +1762,7 @@ void Volume::Convert(Mesh& mesh, const VOXEL_VALUE value) const
     for (size_t i = 0; i < i0; ++i) {
         for (size_t j = 0; j < j0; ++j) {
             for (size_t k = 0; k < k0; ++k) {
-                const unsigned char& voxel = GetVoxel(i, j, k);
+                const unsigned char voxel = GetVoxel(i, j, k);
                 if (voxel == value) {
                     Vec3<double> p0((i - 0.5) * m_scale, (j - 0.5) * m_scale, (k - 0.5) * m_scale);
                     Vec3<double> p1((i + 0.5) * m_scale, (j - 0.5) * m_scale, (k - 0.5) * m_scale);
@@ -896,131 +1798,271 @@ void Volume::Convert(Mesh& mesh, const VOXEL_VALUE value) const
         }
     }
 }
-void Volume::Convert(VoxelSet& vset) const
+void Volume::Convert(VoxelSet& vset, const size_t maxSummedVolumeTableCells, const bool mortonOrder) const
 {
+    // Count the voxels of each column, then fill the slices in parallel at their final offsets: the voxel lists are
+    // allocated once, at their exact sizes.
     for (int h = 0; h < 3; ++h) {
         vset.m_minBB[h] = m_minBB[h];
     }
-    vset.m_voxels.Allocate(m_numVoxelsInsideSurface + m_numVoxelsOnSurface);
+    std::shared_ptr<VoxelGrid> grid(new VoxelGrid);
     vset.m_scale = m_scale;
     vset.m_unitVolume = m_scale * m_scale * m_scale;
     const short i0 = (short)m_dim[0];
     const short j0 = (short)m_dim[1];
     const short k0 = (short)m_dim[2];
-    Voxel voxel;
-    vset.m_numVoxelsOnSurface = 0;
-    vset.m_numVoxelsInsideSurface = 0;
-    for (short i = 0; i < i0; ++i) {
+    grid->m_dim[0] = i0;
+    grid->m_dim[1] = j0;
+    grid->m_dim[2] = k0;
+    grid->m_mortonOrder = mortonOrder;
+    // Over a grid which is not a square of a power of two, some Morton codes are not those of a column: they are
+    // left as empty columns.
+    const size_t nColumns = (i0 > 0 && j0 > 0) ? grid->GetColumn(i0 - 1, j0 - 1) + 1 : 0;
+    grid->m_columns.Resize(nColumns + 1);
+    grid->m_surfaceColumns.Resize(nColumns + 1);
+    size_t* const columns = grid->m_columns.Data();
+    size_t* const surfaceColumns = grid->m_surfaceColumns.Data();
+    memset(columns, 0, sizeof(size_t) * (nColumns + 1));
+    memset(surfaceColumns, 0, sizeof(size_t) * (nColumns + 1));
+#if _OPENMP
+#pragma omp parallel for
+#endif
+    for (int i = 0; i < i0; ++i) {
         for (short j = 0; j < j0; ++j) {
-            for (short k = 0; k < k0; ++k) {
-                const unsigned char& value = GetVoxel(i, j, k);
-                if (value == PRIMITIVE_INSIDE_SURFACE) {
-                    voxel.m_coord[0] = i;
-                    voxel.m_coord[1] = j;
-                    voxel.m_coord[2] = k;
-                    voxel.m_data = PRIMITIVE_INSIDE_SURFACE;
-                    vset.m_voxels.PushBack(voxel);
-                    ++vset.m_numVoxelsInsideSurface;
+            size_t nSolid = 0;
+            size_t nSurface = 0;
+            const size_t rowBrick = GetBrick(i, j, 0);
+            for (size_t b = 0; b < m_brickDim[2]; ++b) {
+                const unsigned int row = GetBrickRow(i, j, rowBrick + b);
+                nSolid += PopCount(SolidVoxels(row));
+                nSurface += PopCount(SolidVoxels(row) & row);
+            }
+            const size_t column = grid->GetColumn(i, j);
+            columns[column + 1] = nSolid;
+            surfaceColumns[column + 1] = nSurface;
+        }
+    }
+    for (size_t c = 0; c < nColumns; ++c) {
+        columns[c + 1] += columns[c];
+        surfaceColumns[c + 1] += surfaceColumns[c];
+    }
+    grid->m_voxels.Resize(columns[nColumns]);
+    grid->m_surfaceVoxels.Resize(surfaceColumns[nColumns]);
+    vset.m_numVoxelsOnSurface = surfaceColumns[nColumns];
+    vset.m_numVoxelsInsideSurface = columns[nColumns] - surfaceColumns[nColumns];
+
+    // The summed-volume tables are built slice by slice: each slice i first gets the sums over its own voxels,
+    // table(i + 1, j + 1, k + 1) = table(i + 1, j, k + 1) + number of voxels of the column (i, j) below k + 1,
+    // which are then accumulated along i.
+    const size_t nk = (size_t)k0 + 1;
+    const size_t njk = ((size_t)j0 + 1) * nk;
+    unsigned int* solidTable = 0;
+    unsigned int* surfaceTable = 0;
+    if (((size_t)i0 + 1) * njk <= maxSummedVolumeTableCells) {
+        grid->m_solidTable.Resize(((size_t)i0 + 1) * njk);
+        grid->m_surfaceTable.Resize(((size_t)i0 + 1) * njk);
+        solidTable = grid->m_solidTable.Data();
+        surfaceTable = grid->m_surfaceTable.Data();
+        memset(solidTable, 0, sizeof(unsigned int) * grid->m_solidTable.Size());
+        memset(surfaceTable, 0, sizeof(unsigned int) * grid->m_surfaceTable.Size());
+    }
+#if _OPENMP
+#pragma omp parallel for
+#endif
+    for (int i = 0; i < i0; ++i) {
+        Voxel voxel;
+        voxel.m_coord[0] = (short)i;
+        for (short j = 0; j < j0; ++j) {
+            const size_t column = grid->GetColumn(i, j);
+            Voxel* voxels = grid->m_voxels.Data() + columns[column];
+            Voxel* surfaceVoxels = grid->m_surfaceVoxels.Data() + surfaceColumns[column];
+            const size_t c0 = (i + 1) * njk + j * nk + 1;
+            const size_t c1 = (i + 1) * njk + (j + 1) * nk + 1;
+            unsigned int nColumnSolid = 0;
+            unsigned int nColumnSurface = 0;
+            voxel.m_coord[1] = j;
+            const size_t rowBrick = GetBrick(i, j, 0);
+            for (size_t b = 0; b < m_brickDim[2]; ++b) {
+                const unsigned int row = GetBrickRow(i, j, rowBrick + b);
+                if (SolidVoxels(row) == 0 && !solidTable) {
+                    continue;
                 }
-                else if (value == PRIMITIVE_ON_SURFACE) {
-                    voxel.m_coord[0] = i;
-                    voxel.m_coord[1] = j;
-                    voxel.m_coord[2] = k;
-                    voxel.m_data = PRIMITIVE_ON_SURFACE;
-                    vset.m_voxels.PushBack(voxel);
-                    ++vset.m_numVoxelsOnSurface;
+                const short kb = (short)(b * BRICK_SIZE);
+                const short kb1 = (short)std::min<size_t>(k0, kb + BRICK_SIZE);
+                for (short k = kb; k < kb1; ++k) {
+                    const unsigned char value = (unsigned char)((row >> (2 * (k - kb))) & 3);
+                    if (solidTable) {
+                        nColumnSolid += (value == PRIMITIVE_INSIDE_SURFACE || value == PRIMITIVE_ON_SURFACE);
+                        nColumnSurface += (value == PRIMITIVE_ON_SURFACE);
+                        solidTable[c1 + k] = solidTable[c0 + k] + nColumnSolid;
+                        surfaceTable[c1 + k] = surfaceTable[c0 + k] + nColumnSurface;
+                    }
+                    if (value == PRIMITIVE_INSIDE_SURFACE || value == PRIMITIVE_ON_SURFACE) {
+                        voxel.m_coord[2] = k;
+                        voxel.m_data = value;
+                        *voxels++ = voxel;
+                        if (value == PRIMITIVE_ON_SURFACE) {
+                            *surfaceVoxels++ = voxel;
+                        }
+                    }
                 }
             }
         }
     }
+    if (solidTable) {
+        for (size_t i = 1; i < (size_t)i0; ++i) {
+            unsigned int* const solidSlice = solidTable + (i + 1) * njk;
+            unsigned int* const surfaceSlice = surfaceTable + (i + 1) * njk;
+#if _OPENMP
+#pragma omp parallel for
+#endif
+            for (long long c = 0; c < (long long)njk; ++c) {
+                solidSlice[c] += solidSlice[c - (long long)njk];
+                surfaceSlice[c] += surfaceSlice[c - (long long)njk];
+            }
+        }
+    }
+    vset.m_grid = grid;
+    vset.m_minWindow[0] = vset.m_minWindow[1] = vset.m_minWindow[2] = 0;
+    vset.m_maxWindow[0] = i0 - 1;
+    vset.m_maxWindow[1] = j0 - 1;
+    vset.m_maxWindow[2] = k0 - 1;
+    vset.m_surfaceFaces = 0;
+    vset.m_surfaceOnly = false;
+    vset.m_counted = true;
 }
 
 void Volume::Convert(TetrahedronSet& tset) const
 {
-    tset.m_tetrahedra.Allocate(5 * (m_numVoxelsInsideSurface + m_numVoxelsOnSurface));
-    tset.m_scale = m_scale;
+    // Count the solid voxels of each slice i, then fill the slices in parallel at their final offsets.
     const short i0 = (short)m_dim[0];
     const short j0 = (short)m_dim[1];
     const short k0 = (short)m_dim[2];
-    tset.m_numTetrahedraOnSurface = 0;
-    tset.m_numTetrahedraInsideSurface = 0;
-    Tetrahedron tetrahedron;
+    SArray<size_t> offsets;
+    offsets.Resize((size_t)i0 + 1);
+    offsets[0] = 0;
+#if _OPENMP
+#pragma omp parallel for
+#endif
+    for (int i = 0; i < i0; ++i) {
+        size_t nVoxels = 0;
+        for (short j = 0; j < j0; ++j) {
+            const size_t rowBrick = GetBrick(i, j, 0);
+            for (size_t b = 0; b < m_brickDim[2]; ++b) {
+                nVoxels += PopCount(SolidVoxels(GetBrickRow(i, j, rowBrick + b)));
+            }
+        }
+        offsets[i + 1] = nVoxels;
+    }
     for (short i = 0; i < i0; ++i) {
+        offsets[i + 1] += offsets[i];
+    }
+    tset.m_tetrahedra.Resize(5 * offsets[i0]);
+    tset.m_scale = m_scale;
+    size_t numTetrahedraOnSurface = 0;
+    size_t numTetrahedraInsideSurface = 0;
+#if _OPENMP
+#pragma omp parallel for reduction(+ : numTetrahedraOnSurface, numTetrahedraInsideSurface)
+#endif
+    for (int i = 0; i < i0; ++i) {
+        Tetrahedron* tetrahedra = tset.m_tetrahedra.Data() + 5 * offsets[i];
+        Tetrahedron tetrahedron;
         for (short j = 0; j < j0; ++j) {
-            for (short k = 0; k < k0; ++k) {
-                const unsigned char& value = GetVoxel(i, j, k);
-                if (value == PRIMITIVE_INSIDE_SURFACE || value == PRIMITIVE_ON_SURFACE) {
-                    tetrahedron.m_data = value;
-                    Vec3<double> p1((i - 0.5) * m_scale + m_minBB[0], (j - 0.5) * m_scale + m_minBB[1], (k - 0.5) * m_scale + m_minBB[2]);
-                    Vec3<double> p2((i + 0.5) * m_scale + m_minBB[0], (j - 0.5) * m_scale + m_minBB[1], (k - 0.5) * m_scale + m_minBB[2]);
-                    Vec3<double> p3((i + 0.5) * m_scale + m_minBB[0], (j + 0.5) * m_scale + m_minBB[1], (k - 0.5) * m_scale + m_minBB[2]);
-                    Vec3<double> p4((i - 0.5) * m_scale + m_minBB[0], (j + 0.5) * m_scale + m_minBB[1], (k - 0.5) * m_scale + m_minBB[2]);
-                    Vec3<double> p5((i - 0.5) * m_scale + m_minBB[0], (j - 0.5) * m_scale + m_minBB[1], (k + 0.5) * m_scale + m_minBB[2]);
-                    Vec3<double> p6((i + 0.5) * m_scale + m_minBB[0], (j - 0.5) * m_scale + m_minBB[1], (k + 0.5) * m_scale + m_minBB[2]);
-                    Vec3<double> p7((i + 0.5) * m_scale + m_minBB[0], (j + 0.5) * m_scale + m_minBB[1], (k + 0.5) * m_scale + m_minBB[2]);
-                    Vec3<double> p8((i - 0.5) * m_scale + m_minBB[0], (j + 0.5) * m_scale + m_minBB[1], (k + 0.5) * m_scale + m_minBB[2]);
-
-                    tetrahedron.m_pts[0] = p2;
-                    tetrahedron.m_pts[1] = p4;
-                    tetrahedron.m_pts[2] = p7;
-                    tetrahedron.m_pts[3] = p5;
-                    tset.m_tetrahedra.PushBack(tetrahedron);
-
-                    tetrahedron.m_pts[0] = p6;
-                    tetrahedron.m_pts[1] = p2;
-                    tetrahedron.m_pts[2] = p7;
-                    tetrahedron.m_pts[3] = p5;
-                    tset.m_tetrahedra.PushBack(tetrahedron);
-
-                    tetrahedron.m_pts[0] = p3;
-                    tetrahedron.m_pts[1] = p4;
-                    tetrahedron.m_pts[2] = p7;
-                    tetrahedron.m_pts[3] = p2;
-                    tset.m_tetrahedra.PushBack(tetrahedron);
-
-                    tetrahedron.m_pts[0] = p1;
-                    tetrahedron.m_pts[1] = p4;
-                    tetrahedron.m_pts[2] = p2;
-                    tetrahedron.m_pts[3] = p5;
-                    tset.m_tetrahedra.PushBack(tetrahedron);
-
-                    tetrahedron.m_pts[0] = p8;
-                    tetrahedron.m_pts[1] = p5;
-                    tetrahedron.m_pts[2] = p7;
-                    tetrahedron.m_pts[3] = p4;
-                    tset.m_tetrahedra.PushBack(tetrahedron);
-                    if (value == PRIMITIVE_INSIDE_SURFACE) {
-                        tset.m_numTetrahedraInsideSurface += 5;
-                    }
-                    else {
-                        tset.m_numTetrahedraOnSurface += 5;
+            const size_t rowBrick = GetBrick(i, j, 0);
+            for (size_t b = 0; b < m_brickDim[2]; ++b) {
+                const unsigned int row = GetBrickRow(i, j, rowBrick + b);
+                if (SolidVoxels(row) == 0) {
+                    continue;
+                }
+                const short kb = (short)(b * BRICK_SIZE);
+                const short kb1 = (short)std::min<size_t>(k0, kb + BRICK_SIZE);
+                for (short k = kb; k < kb1; ++k) {
+                    const unsigned char value = (unsigned char)((row >> (2 * (k - kb))) & 3);
+                    if (value == PRIMITIVE_INSIDE_SURFACE || value == PRIMITIVE_ON_SURFACE) {
+                        tetrahedron.m_data = value;
+                        Vec3<double> p1((i - 0.5) * m_scale + m_minBB[0], (j - 0.5) * m_scale + m_minBB[1], (k - 0.5) * m_scale + m_minBB[2]);
+                        Vec3<double> p2((i + 0.5) * m_scale + m_minBB[0], (j - 0.5) * m_scale + m_minBB[1], (k - 0.5) * m_scale + m_minBB[2]);
+                        Vec3<double> p3((i + 0.5) * m_scale + m_minBB[0], (j + 0.5) * m_scale + m_minBB[1], (k - 0.5) * m_scale + m_minBB[2]);
+                        Vec3<double> p4((i - 0.5) * m_scale + m_minBB[0], (j + 0.5) * m_scale + m_minBB[1], (k - 0.5) * m_scale + m_minBB[2]);
+                        Vec3<double> p5((i - 0.5) * m_scale + m_minBB[0], (j - 0.5) * m_scale + m_minBB[1], (k + 0.5) * m_scale + m_minBB[2]);
+                        Vec3<double> p6((i + 0.5) * m_scale + m_minBB[0], (j - 0.5) * m_scale + m_minBB[1], (k + 0.5) * m_scale + m_minBB[2]);
+                        Vec3<double> p7((i + 0.5) * m_scale + m_minBB[0], (j + 0.5) * m_scale + m_minBB[1], (k + 0.5) * m_scale + m_minBB[2]);
+                        Vec3<double> p8((i - 0.5) * m_scale + m_minBB[0], (j + 0.5) * m_scale + m_minBB[1], (k + 0.5) * m_scale + m_minBB[2]);
+
+                        tetrahedron.m_pts[0] = p2;
+                        tetrahedron.m_pts[1] = p4;
+                        tetrahedron.m_pts[2] = p7;
+                        tetrahedron.m_pts[3] = p5;
+                        *tetrahedra++ = tetrahedron;
+
+                        tetrahedron.m_pts[0] = p6;
+                        tetrahedron.m_pts[1] = p2;
+                        tetrahedron.m_pts[2] = p7;
+                        tetrahedron.m_pts[3] = p5;
+                        *tetrahedra++ = tetrahedron;
+
+                        tetrahedron.m_pts[0] = p3;
+                        tetrahedron.m_pts[1] = p4;
+                        tetrahedron.m_pts[2] = p7;
+                        tetrahedron.m_pts[3] = p2;
+                        *tetrahedra++ = tetrahedron;
+
+                        tetrahedron.m_pts[0] = p1;
+                        tetrahedron.m_pts[1] = p4;
+                        tetrahedron.m_pts[2] = p2;
+                        tetrahedron.m_pts[3] = p5;
+                        *tetrahedra++ = tetrahedron;
+
+                        tetrahedron.m_pts[0] = p8;
+                        tetrahedron.m_pts[1] = p5;
+                        tetrahedron.m_pts[2] = p7;
+                        tetrahedron.m_pts[3] = p4;
+                        *tetrahedra++ = tetrahedron;
+                        if (value == PRIMITIVE_INSIDE_SURFACE) {
+                            numTetrahedraInsideSurface += 5;
+                        }
+                        else {
+                            numTetrahedraOnSurface += 5;
+                        }
                     }
                 }
             }
         }
     }
+    tset.m_numTetrahedraOnSurface = numTetrahedraOnSurface;
+    tset.m_numTetrahedraInsideSurface = numTetrahedraInsideSurface;
 }
 
 void Volume::AlignToPrincipalAxes(double (&rot)[3][3]) const
 {
     const short i0 = (short)m_dim[0];
     const short j0 = (short)m_dim[1];
-    const short k0 = (short)m_dim[2];
-    Vec3<double> barycenter(0.0);
-    size_t nVoxels = 0;
-    for (short i = 0; i < i0; ++i) {
+    // integer sums: exact, whatever the order of the slices
+    unsigned long long sumI = 0;
+    unsigned long long sumJ = 0;
+    unsigned long long sumK = 0;
+    unsigned long long nSolid = 0;
+#if _OPENMP
+#pragma omp parallel for reduction(+ : sumI, sumJ, sumK, nSolid)
+#endif
+    for (int i = 0; i < i0; ++i) {
         for (short j = 0; j < j0; ++j) {
-            for (short k = 0; k < k0; ++k) {
-                const unsigned char& value = GetVoxel(i, j, k);
-                if (value == PRIMITIVE_INSIDE_SURFACE || value == PRIMITIVE_ON_SURFACE) {
-                    barycenter[0] += i;
-                    barycenter[1] += j;
-                    barycenter[2] += k;
-                    ++nVoxels;
+            const size_t rowBrick = GetBrick(i, j, 0);
+            for (size_t b = 0; b < m_brickDim[2]; ++b) {
+                unsigned int solid = SolidVoxels(GetBrickRow(i, j, rowBrick + b));
+                for (size_t k = b * BRICK_SIZE; solid; solid >>= 2, ++k) {
+                    if (solid & 1) {
+                        sumI += i;
+                        sumJ += j;
+                        sumK += k;
+                        ++nSolid;
+                    }
                 }
             }
         }
     }
+    const size_t nVoxels = (size_t)nSolid;
+    Vec3<double> barycenter((double)sumI, (double)sumJ, (double)sumK);
     barycenter /= (double)nVoxels;
 
     double covMat[3][3] = { { 0.0, 0.0, 0.0 },
@@ -1029,18 +2071,21 @@ void Volume::AlignToPrincipalAxes(double (&rot)[3][3]) const
     double x, y, z;
     for (short i = 0; i < i0; ++i) {
         for (short j = 0; j < j0; ++j) {
-            for (short k = 0; k < k0; ++k) {
-                const unsigned char& value = GetVoxel(i, j, k);
-                if (value == PRIMITIVE_INSIDE_SURFACE || value == PRIMITIVE_ON_SURFACE) {
-                    x = i - barycenter[0];
-                    y = j - barycenter[1];
-                    z = k - barycenter[2];
-                    covMat[0][0] += x * x;
-                    covMat[1][1] += y * y;
-                    covMat[2][2] += z * z;
-                    covMat[0][1] += x * y;
-                    covMat[0][2] += x * z;
-                    covMat[1][2] += y * z;
+            const size_t rowBrick = GetBrick(i, j, 0);
+            for (size_t b = 0; b < m_brickDim[2]; ++b) {
+                unsigned int solid = SolidVoxels(GetBrickRow(i, j, rowBrick + b));
+                for (short k = (short)(b * BRICK_SIZE); solid; solid >>= 2, ++k) {
+                    if (solid & 1) {
+                        x = i - barycenter[0];
+                        y = j - barycenter[1];
+                        z = k - barycenter[2];
+                        covMat[0][0] += x * x;
+                        covMat[1][1] += y * y;
+                        covMat[2][2] += z * z;
+                        covMat[0][1] += x * y;
+                        covMat[0][2] += x * z;
+                        covMat[1][2] += y * z;
+                    }
                 }
             }
         }
@@ -1088,16 +2133,17 @@ void TetrahedronSet::ComputeBB()
     }
     m_barycenter /= (double)(4 * nTetrahedra);
 }
-void TetrahedronSet::ComputeConvexHull(Mesh& meshCH, const size_t sampling) const
+size_t TetrahedronSet::ComputeConvexHull(Mesh& meshCH, const size_t sampling) const
 {
     const size_t CLUSTER_SIZE = 65536;
     const size_t nTetrahedra = m_tetrahedra.Size();
     if (nTetrahedra == 0)
-        return;
+        return 0;
 
     SArray<Vec3<double> > cpoints;
 
     Vec3<double>* points = new Vec3<double>[CLUSTER_SIZE];
+    size_t nPoints = 0;
     size_t p = 0;
     while (p < nTetrahedra) {
         size_t q = 0;
@@ -1120,6 +2166,7 @@ void TetrahedronSet::ComputeConvexHull(Mesh& meshCH, const size_t sampling) cons
         }
         btConvexHullComputer ch;
         ch.compute((double*)points, 3 * sizeof(double), (int)q, -1.0, -1.0);
+        nPoints += q;
         for (int v = 0; v < ch.vertices.size(); v++) {
             cpoints.PushBack(Vec3<double>(ch.vertices[v].getX(), ch.vertices[v].getY(), ch.vertices[v].getZ()));
         }
@@ -1129,6 +2176,7 @@ void TetrahedronSet::ComputeConvexHull(Mesh& meshCH, const size_t sampling) cons
     points = cpoints.Data();
     btConvexHullComputer ch;
     ch.compute((double*)points, 3 * sizeof(double), (int)cpoints.Size(), -1.0, -1.0);
+    nPoints += cpoints.Size();
     meshCH.ResizePoints(0);
     meshCH.ResizeTriangles(0);
     for (int v = 0; v < ch.vertices.size(); v++) {
@@ -1148,6 +2196,7 @@ void TetrahedronSet::ComputeConvexHull(Mesh& meshCH, const size_t sampling) cons
             c = edge->getTargetVertex();
         }
     }
+    return nPoints;
 }
 inline bool TetrahedronSet::Add(Tetrahedron& tetrahedron)
 {
@@ -1372,6 +2421,18 @@ void TetrahedronSet::ComputeClippedVolumes(const Plane& plane,
     if (nTetrahedra == 0)
         return;
 }
+void TetrahedronSet::ComputeClippedVolumes(const SArray<Plane>& planes,
+    SArray<double>& positiveVolumes,
+    SArray<double>& negativeVolumes) const
+{
+    const size_t nPlanes = planes.Size();
+    positiveVolumes.Resize(nPlanes);
+    negativeVolumes.Resize(nPlanes);
+    for (size_t p = 0; p < nPlanes; ++p) {
+        positiveVolumes[p] = negativeVolumes[p] = 0.0;
+        ComputeClippedVolumes(planes[p], positiveVolumes[p], negativeVolumes[p]);
+    }
+}
 
 void TetrahedronSet::SelectOnSurface(PrimitiveSet* const onSurfP) const
 {
@@ -1563,6 +2624,7 @@ void TetrahedronSet::RevertAlignToPrincipalAxes()
         }
     }
     ComputeBB();
+    GetConvexHull().Clear(); // computed in the aligned frame
 }
 void TetrahedronSet::ComputePrincipalAxes()
 {
@@ -1617,5 +2679,6 @@ void TetrahedronSet::AlignToPrincipalAxes()
         }
     }
     ComputeBB();
+    GetConvexHull().Clear(); // computed in the original frame
 }
 }
@@ -0,0 +1,398 @@
+// vhacd_bench : headless benchmark driver for V-HACD.
+//
+// Loads one or more wavefront OBJ files, runs the synchronous IVHACD::Compute on each of them and reports
+// the wall time of every stage, the V-HACD statistics, the resulting hull counts and the peak resident set size of the
+// process as CSV or JSON. The peak is process-wide: it is the largest of the runs done so far, not that of the run.
+//
+// Build (Linux):
+//   g++ -O2 -fopenmp -I.. -I../VHACD/inc -I../VHACD/public vhacd_bench.cpp ../wavefront.cpp ../VHACD/src/*.cpp -o vhacd_bench
+//
+// Usage:
+//   vhacd_bench [options] mesh.obj [mesh.obj ...]
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+#include "wavefront.h"
+#include "VHACD.h"
+
+// The stages timed by V-HACD, in pipeline order.
+enum BenchStage
+{
+	BS_ALIGN_MESH,
+	BS_VOXELIZATION,
+	BS_PRIMITIVE_SET,
+	BS_ACD,
+	BS_MERGE,
+	BS_SIMPLIFY,
+	BS_LAST
+};
+
+static const char *gStageColumns[BS_LAST] =
+{
+	"align",
+	"voxelization",
+	"primitive_set",
+	"acd",
+	"merge",
+	"simplify",
+};
+
+typedef std::chrono::steady_clock BenchClock;
+
+static double getSeconds(const BenchClock::time_point &start, const BenchClock::time_point &end)
+{
+	return std::chrono::duration<double>(end - start).count();
+}
+
+// Peak resident set size of the process so far, in kilobytes.
+static uint64_t getProcessPeakRSS(void)
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+	{
+		return uint64_t(pmc.PeakWorkingSetSize / 1024);
+	}
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+	{
+#ifdef __APPLE__
+		return uint64_t(usage.ru_maxrss / 1024); // bytes on macOS
+#else
+		return uint64_t(usage.ru_maxrss);
+#endif
+	}
+	return 0;
+#endif
+}
+
+static void getStageSeconds(const VHACD::IVHACD::Stats &stats, double seconds[BS_LAST])
+{
+	seconds[BS_ALIGN_MESH] = stats.m_alignMeshTime / 1000.0;
+	seconds[BS_VOXELIZATION] = stats.m_voxelizationTime / 1000.0;
+	seconds[BS_PRIMITIVE_SET] = stats.m_primitiveSetTime / 1000.0;
+	seconds[BS_ACD] = stats.m_acdTime / 1000.0;
+	seconds[BS_MERGE] = stats.m_mergeTime / 1000.0;
+	seconds[BS_SIMPLIFY] = stats.m_simplifyTime / 1000.0;
+}
+
+struct BenchResult
+{
+	std::string	mMesh;
+	uint32_t	mRun;
+	uint32_t	mVertexCount;
+	uint32_t	mTriangleCount;
+	bool		mOk;
+	double		mStageSeconds[BS_LAST];
+	double		mTotalSeconds;
+	uint32_t	mHullCount;
+	uint32_t	mHullPoints;
+	uint32_t	mHullTriangles;
+	uint64_t	mProcessPeakRSS;
+	VHACD::IVHACD::Stats	mStats;
+};
+
+static void printUsage(void)
+{
+	printf("Usage: vhacd_bench [options] mesh.obj [mesh.obj ...]\n");
+	printf("Options:\n");
+	printf("  -r, --resolution <n>            maximum number of voxels (default 100000)\n");
+	printf("  -d, --depth <n>                 maximum number of clipping stages (default 20)\n");
+	printf("  -c, --concavity <f>             maximum allowed concavity (default 0.001)\n");
+	printf("  --planeDownsampling <n>         granularity of the clipping plane search (default 4)\n");
+	printf("  --convexhullDownsampling <n>    precision of the hull generation during clipping (default 4)\n");
+	printf("  --alpha <f>                     bias toward clipping along symmetry planes (default 0.05)\n");
+	printf("  --beta <f>                      bias toward clipping along revolution axes (default 0.05)\n");
+	printf("  --gamma <f>                     maximum concavity during the merge stage (default 0.0005)\n");
+	printf("  --pca <0|1>                     normalize the mesh before decomposition (default 0)\n");
+	printf("  --mode <0|1>                    0: voxel-based, 1: tetrahedron-based (default 0)\n");
+	printf("  --maxNumVerticesPerCH <n>       maximum number of vertices per hull (default 64)\n");
+	printf("  --minVolumePerCH <f>            adaptive hull sampling volume (default 0.0001)\n");
+	printf("  --convexhullApproximation <0|1> approximate hulls during clipping (default 1)\n");
+	printf("  --maxConvexHulls <n>            maximum number of hulls (default 1024)\n");
+	printf("  --mortonOrder <0|1>             store the voxels in Morton order (default 0)\n");
+	printf("  -n, --repeat <n>                number of runs per mesh (default 1)\n");
+	printf("  -f, --format <csv|json>         output format (default csv)\n");
+	printf("  -o, --output <file>             write the report to a file instead of stdout\n");
+}
+
+static bool parseArguments(int argc, const char **argv, VHACD::IVHACD::Parameters &desc,
+	std::vector< std::string > &meshes, uint32_t &repeat, bool &json, const char *&output)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const char *arg = argv[i];
+		if (arg[0] != '-')
+		{
+			meshes.push_back(arg);
+			continue;
+		}
+		if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0)
+		{
+			return false;
+		}
+		if (i + 1 >= argc)
+		{
+			fprintf(stderr, "Missing value for option '%s'\n", arg);
+			return false;
+		}
+		const char *value = argv[++i];
+		if (strcmp(arg, "-r") == 0 || strcmp(arg, "--resolution") == 0)
+		{
+			desc.m_resolution = uint32_t(atoi(value));
+		}
+		else if (strcmp(arg, "-d") == 0 || strcmp(arg, "--depth") == 0)
+		{
+			desc.m_depth = atoi(value);
+		}
+		else if (strcmp(arg, "-c") == 0 || strcmp(arg, "--concavity") == 0)
+		{
+			desc.m_concavity = atof(value);
+		}
+		else if (strcmp(arg, "--planeDownsampling") == 0)
+		{
+			desc.m_planeDownsampling = atoi(value);
+		}
+		else if (strcmp(arg, "--convexhullDownsampling") == 0)
+		{
+			desc.m_convexhullDownsampling = atoi(value);
+		}
+		else if (strcmp(arg, "--alpha") == 0)
+		{
+			desc.m_alpha = atof(value);
+		}
+		else if (strcmp(arg, "--beta") == 0)
+		{
+			desc.m_beta = atof(value);
+		}
+		else if (strcmp(arg, "--gamma") == 0)
+		{
+			desc.m_gamma = atof(value);
+		}
+		else if (strcmp(arg, "--pca") == 0)
+		{
+			desc.m_pca = atoi(value);
+		}
+		else if (strcmp(arg, "--mode") == 0)
+		{
+			desc.m_mode = atoi(value);
+		}
+		else if (strcmp(arg, "--maxNumVerticesPerCH") == 0)
+		{
+			desc.m_maxNumVerticesPerCH = uint32_t(atoi(value));
+		}
+		else if (strcmp(arg, "--minVolumePerCH") == 0)
+		{
+			desc.m_minVolumePerCH = atof(value);
+		}
+		else if (strcmp(arg, "--convexhullApproximation") == 0)
+		{
+			desc.m_convexhullApproximation = atoi(value);
+		}
+		else if (strcmp(arg, "--maxConvexHulls") == 0)
+		{
+			desc.m_maxConvexHulls = uint32_t(atoi(value));
+		}
+		else if (strcmp(arg, "--mortonOrder") == 0)
+		{
+			desc.m_mortonOrder = atoi(value);
+		}
+		else if (strcmp(arg, "-n") == 0 || strcmp(arg, "--repeat") == 0)
+		{
+			int n = atoi(value);
+			repeat = n > 0 ? uint32_t(n) : 1;
+		}
+		else if (strcmp(arg, "-f") == 0 || strcmp(arg, "--format") == 0)
+		{
+			if (strcmp(value, "json") == 0)
+			{
+				json = true;
+			}
+			else if (strcmp(value, "csv") == 0)
+			{
+				json = false;
+			}
+			else
+			{
+				fprintf(stderr, "Unknown output format '%s'\n", value);
+				return false;
+			}
+		}
+		else if (strcmp(arg, "-o") == 0 || strcmp(arg, "--output") == 0)
+		{
+			output = value;
+		}
+		else
+		{
+			fprintf(stderr, "Unknown option '%s'\n", arg);
+			return false;
+		}
+	}
+	return !meshes.empty();
+}
+
+static void writeCSV(FILE *fph, const std::vector< BenchResult > &results)
+{
+	fprintf(fph, "mesh,run,vertices,triangles,ok");
+	for (uint32_t i = 0; i < BS_LAST; i++)
+	{
+		fprintf(fph, ",%s_s", gStageColumns[i]);
+	}
+	fprintf(fph, ",total_s,hulls,hull_points,hull_triangles,process_peak_rss_kb");
+	fprintf(fph, ",dim,voxelizations,voxels_on_surface,voxels_inside_surface,planes,ch_computations,ch_points,merge_iterations\n");
+	for (size_t j = 0; j < results.size(); j++)
+	{
+		const BenchResult &r = results[j];
+		fprintf(fph, "%s,%u,%u,%u,%d", r.mMesh.c_str(), r.mRun, r.mVertexCount, r.mTriangleCount, r.mOk ? 1 : 0);
+		for (uint32_t i = 0; i < BS_LAST; i++)
+		{
+			fprintf(fph, ",%.6f", r.mStageSeconds[i]);
+		}
+		fprintf(fph, ",%.6f,%u,%u,%u,%llu", r.mTotalSeconds, r.mHullCount, r.mHullPoints, r.mHullTriangles,
+			(unsigned long long)r.mProcessPeakRSS);
+		const VHACD::IVHACD::Stats &st = r.mStats;
+		fprintf(fph, ",%u,%u,%u,%u,%u,%u,%llu,%u\n", st.m_dim, st.m_nVoxelizations, st.m_nVoxelsOnSurface,
+			st.m_nVoxelsInsideSurface, st.m_nPlanes, st.m_nConvexHullComputations, st.m_nConvexHullPoints,
+			st.m_nMergeIterations);
+	}
+}
+
+static void writeJSON(FILE *fph, const VHACD::IVHACD::Parameters &desc, const std::vector< BenchResult > &results)
+{
+	fprintf(fph, "{\n");
+	fprintf(fph, "  \"parameters\": {\"resolution\": %u, \"depth\": %d, \"concavity\": %g, \"planeDownsampling\": %d, "
+		"\"convexhullDownsampling\": %d, \"alpha\": %g, \"beta\": %g, \"gamma\": %g, \"pca\": %d, \"mode\": %d, "
+		"\"maxNumVerticesPerCH\": %u, \"minVolumePerCH\": %g, \"convexhullApproximation\": %d, \"maxConvexHulls\": %u, "
+		"\"mortonOrder\": %d},\n",
+		desc.m_resolution, desc.m_depth, desc.m_concavity, desc.m_planeDownsampling, desc.m_convexhullDownsampling,
+		desc.m_alpha, desc.m_beta, desc.m_gamma, desc.m_pca, desc.m_mode, desc.m_maxNumVerticesPerCH,
+		desc.m_minVolumePerCH, desc.m_convexhullApproximation, desc.m_maxConvexHulls, desc.m_mortonOrder);
+	fprintf(fph, "  \"results\": [\n");
+	for (size_t j = 0; j < results.size(); j++)
+	{
+		const BenchResult &r = results[j];
+		fprintf(fph, "    {\"mesh\": \"");
+		for (const char *c = r.mMesh.c_str(); *c; c++)
+		{
+			if (*c == '"' || *c == '\\')
+			{
+				fputc('\\', fph);
+			}
+			fputc(*c, fph);
+		}
+		fprintf(fph, "\", \"run\": %u, \"vertices\": %u, \"triangles\": %u, \"ok\": %s, \"stages\": {",
+			r.mRun, r.mVertexCount, r.mTriangleCount, r.mOk ? "true" : "false");
+		for (uint32_t i = 0; i < BS_LAST; i++)
+		{
+			fprintf(fph, "%s\"%s\": %.6f", i ? ", " : "", gStageColumns[i], r.mStageSeconds[i]);
+		}
+		fprintf(fph, "}, \"total\": %.6f, \"hulls\": %u, \"hullPoints\": %u, \"hullTriangles\": %u, \"processPeakRSSKB\": %llu",
+			r.mTotalSeconds, r.mHullCount, r.mHullPoints, r.mHullTriangles, (unsigned long long)r.mProcessPeakRSS);
+		const VHACD::IVHACD::Stats &st = r.mStats;
+		fprintf(fph, ", \"dim\": %u, \"voxelizations\": %u, \"voxelsOnSurface\": %u, \"voxelsInsideSurface\": %u, \"planes\": %u, "
+			"\"convexHullComputations\": %u, \"convexHullPoints\": %llu, \"mergeIterations\": %u}%s\n",
+			st.m_dim, st.m_nVoxelizations, st.m_nVoxelsOnSurface, st.m_nVoxelsInsideSurface, st.m_nPlanes,
+			st.m_nConvexHullComputations, st.m_nConvexHullPoints, st.m_nMergeIterations,
+			(j + 1 < results.size()) ? "," : "");
+	}
+	fprintf(fph, "  ]\n");
+	fprintf(fph, "}\n");
+}
+
+int main(int argc, const char **argv)
+{
+	VHACD::IVHACD::Parameters desc;
+	desc.m_oclAcceleration = 0;
+	std::vector< std::string > meshes;
+	uint32_t repeat = 1;
+	bool json = false;
+	const char *output = NULL;
+
+	if (!parseArguments(argc, argv, desc, meshes, repeat, json, output))
+	{
+		printUsage();
+		return 1;
+	}
+
+	std::vector< BenchResult > results;
+	VHACD::IVHACD *hacd = VHACD::CreateVHACD();
+	for (size_t m = 0; m < meshes.size(); m++)
+	{
+		WavefrontObj obj;
+		uint32_t tcount = obj.loadObj(meshes[m].c_str());
+		if (tcount == 0)
+		{
+			fprintf(stderr, "Failed to load any triangles from '%s'\n", meshes[m].c_str());
+			continue;
+		}
+		for (uint32_t run = 0; run < repeat; run++)
+		{
+			BenchResult r;
+			r.mMesh = meshes[m];
+			r.mRun = run;
+			r.mVertexCount = obj.mVertexCount;
+			r.mTriangleCount = obj.mTriCount;
+
+			BenchClock::time_point start = BenchClock::now();
+			r.mOk = hacd->Compute(obj.mVertices, 3, obj.mVertexCount,
+				(const int *)obj.mIndices, 3, obj.mTriCount, desc);
+			r.mTotalSeconds = getSeconds(start, BenchClock::now());
+
+			hacd->GetStats(r.mStats);
+			getStageSeconds(r.mStats, r.mStageSeconds);
+			r.mHullCount = hacd->GetNConvexHulls();
+			r.mHullPoints = 0;
+			r.mHullTriangles = 0;
+			for (uint32_t i = 0; i < r.mHullCount; i++)
+			{
+				VHACD::IVHACD::ConvexHull ch;
+				hacd->GetConvexHull(i, ch);
+				r.mHullPoints += ch.m_nPoints;
+				r.mHullTriangles += ch.m_nTriangles;
+			}
+			r.mProcessPeakRSS = getProcessPeakRSS();
+			results.push_back(r);
+			hacd->Clean();
+		}
+	}
+	hacd->Release();
+
+	FILE *fph = stdout;
+	if (output)
+	{
+		fph = fopen(output, "w");
+		if (fph == NULL)
+		{
+			fprintf(stderr, "Failed to open '%s' for write access\n", output);
+			return 1;
+		}
+	}
+	if (json)
+	{
+		writeJSON(fph, desc, results);
+	}
+	else
+	{
+		writeCSV(fph, results);
+	}
+	if (fph != stdout)
+	{
+		fclose(fph);
+	}
+	return results.empty() ? 1 : 0;
+}
@@ -0,0 +1,161 @@
+// volume_bench : benchmark of the dense voxel grid passes of V-HACD.
+//
+// Voxelizes a wavefront OBJ file, or a procedural torus when no file is given, at grid sizes of 128, 256 and 512
+// voxels and reports the wall time of the voxelization, of the conversions to voxel and tetrahedron sets and of
+// the principal axes computation, together with the voxel counts, as CSV. The tetrahedron set takes five
+// tetrahedra per voxel and is only built on request. The convex-hull of the voxel set is computed in clusters of
+// 8192 surface voxels, taken in the storage order of the set: with --morton the columns are stored in Morton order,
+// and hull_points reports the points fed to the hull computations, cluster hulls included.
+//
+// Build (Linux):
+//   g++ -O2 -fopenmp -I.. -I../VHACD/inc -I../VHACD/public volume_bench.cpp ../wavefront.cpp ../VHACD/src/*.cpp -o volume_bench
+//
+// Usage:
+//   volume_bench [-n <runs>] [--tetrahedra] [--morton] [mesh.obj]
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <chrono>
+
+#include "wavefront.h"
+#include "vhacdVolume.h"
+
+typedef std::chrono::steady_clock BenchClock;
+
+static double getSeconds(const BenchClock::time_point &start, const BenchClock::time_point &end)
+{
+	return std::chrono::duration<double>(end - start).count();
+}
+
+// Torus of radii 1 and 0.35 around the z axis, its tube stretched along z so that its bounding box is a cube: the
+// voxel grid, which has dim voxels along the shortest side of the box, then has dim^3 voxels.
+static void buildTorus(uint32_t segments, std::vector< float > &vertices, std::vector< int > &indices)
+{
+	const uint32_t rings = segments / 2;
+	const double pi = 3.14159265358979323846;
+	for (uint32_t s = 0; s < segments; s++)
+	{
+		const double u = 2.0 * pi * s / segments;
+		for (uint32_t r = 0; r < rings; r++)
+		{
+			const double v = 2.0 * pi * r / rings;
+			const double radius = 1.0 + 0.35 * cos(v);
+			vertices.push_back(float(radius * cos(u)));
+			vertices.push_back(float(radius * sin(u)));
+			vertices.push_back(float(1.35 * sin(v)));
+		}
+	}
+	for (uint32_t s = 0; s < segments; s++)
+	{
+		const uint32_t s1 = (s + 1) % segments;
+		for (uint32_t r = 0; r < rings; r++)
+		{
+			const uint32_t r1 = (r + 1) % rings;
+			const int a = int(s * rings + r);
+			const int b = int(s1 * rings + r);
+			const int c = int(s1 * rings + r1);
+			const int d = int(s * rings + r1);
+			indices.push_back(a);
+			indices.push_back(b);
+			indices.push_back(c);
+			indices.push_back(a);
+			indices.push_back(c);
+			indices.push_back(d);
+		}
+	}
+}
+
+int main(int argc, const char **argv)
+{
+	uint32_t repeat = 1;
+	bool tetrahedra = false;
+	bool morton = false;
+	const char *meshName = NULL;
+	for (int i = 1; i < argc; i++)
+	{
+		if ((strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--repeat") == 0) && i + 1 < argc)
+		{
+			repeat = uint32_t(atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--tetrahedra") == 0)
+		{
+			tetrahedra = true;
+		}
+		else if (strcmp(argv[i], "--morton") == 0)
+		{
+			morton = true;
+		}
+		else if (argv[i][0] != '-')
+		{
+			meshName = argv[i];
+		}
+		else
+		{
+			printf("Usage: volume_bench [-n <runs>] [--tetrahedra] [--morton] [mesh.obj]\n");
+			return 1;
+		}
+	}
+
+	std::vector< float > vertices;
+	std::vector< int > indices;
+	WavefrontObj obj;
+	if (meshName)
+	{
+		if (obj.loadObj(meshName) == 0)
+		{
+			fprintf(stderr, "Failed to load mesh '%s'\n", meshName);
+			return 1;
+		}
+		vertices.assign(obj.mVertices, obj.mVertices + obj.mVertexCount * 3);
+		indices.assign(obj.mIndices, obj.mIndices + obj.mTriCount * 3);
+	}
+	else
+	{
+		meshName = "torus";
+		buildTorus(256, vertices, indices);
+	}
+	const uint32_t vcount = uint32_t(vertices.size() / 3);
+	const uint32_t tcount = uint32_t(indices.size() / 3);
+
+	const VHACD::Vec3<double> barycenter(0.0, 0.0, 0.0);
+	const double rot[3][3] = { { 1.0, 0.0, 0.0 }, { 0.0, 1.0, 0.0 }, { 0.0, 0.0, 1.0 } };
+	printf("mesh,dim,run,on_surface,inside_surface,voxelize,convert_voxels,convert_tetrahedra,principal_axes,convex_hull,hull_points\n");
+	const size_t dims[] = { 128, 256, 512 };
+	for (size_t d = 0; d < sizeof(dims) / sizeof(dims[0]); d++)
+	{
+		for (uint32_t run = 0; run < repeat; run++)
+		{
+			VHACD::Volume volume;
+			BenchClock::time_point t0 = BenchClock::now();
+			volume.Voxelize(&vertices[0], 3, vcount, &indices[0], 3, tcount, dims[d], barycenter, rot);
+			BenchClock::time_point t1 = BenchClock::now();
+			VHACD::VoxelSet vset;
+			volume.Convert(vset, 0, morton);
+			const double voxelsSeconds = getSeconds(t1, BenchClock::now());
+			double tetrahedraSeconds = 0.0;
+			if (tetrahedra)
+			{
+				BenchClock::time_point t2 = BenchClock::now();
+				VHACD::TetrahedronSet tset;
+				volume.Convert(tset);
+				tetrahedraSeconds = getSeconds(t2, BenchClock::now());
+			}
+			BenchClock::time_point t3 = BenchClock::now();
+			double axes[3][3];
+			volume.AlignToPrincipalAxes(axes);
+			const double axesSeconds = getSeconds(t3, BenchClock::now());
+			BenchClock::time_point t4 = BenchClock::now();
+			VHACD::Mesh hull;
+			const size_t hullPoints = vset.ComputeConvexHull(hull);
+			const double hullSeconds = getSeconds(t4, BenchClock::now());
+			printf("%s,%u,%u,%u,%u,%f,%f,%f,%f,%f,%u\n", meshName, uint32_t(dims[d]), run,
+				uint32_t(volume.GetNPrimitivesOnSurf()), uint32_t(volume.GetNPrimitivesInsideSurf()),
+				getSeconds(t0, t1), voxelsSeconds, tetrahedraSeconds, axesSeconds, hullSeconds, uint32_t(hullPoints));
+			fflush(stdout);
+		}
+	}
+	return 0;
+}
@@ -4,7 +4,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
-#include <ctype.h>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "wavefront.h"
@@ -45,7 +46,18 @@
 */
 
 #ifdef _WIN32
-#	define strcasecmp _stricmp 
+#	ifndef WIN32_LEAN_AND_MEAN
+#		define WIN32_LEAN_AND_MEAN
+#	endif
+#	ifndef NOMINMAX
+#		define NOMINMAX
+#	endif
+#	include <windows.h>
+#else
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
 #endif
 
 #pragma warning(disable:4996)
@@ -57,563 +69,423 @@ namespace WAVEFRONT
 {
 
 /*******************************************************************/
-/******************** InParser.h  ********************************/
+/******************** MappedFile  **********************************/
 /*******************************************************************/
-class InPlaceParserInterface
+// Read only view of an entire file, memory mapped so that it is paged in by the threads parsing it
+// rather than copied into a heap buffer first.
+class MappedFile
 {
 public:
-	virtual uint32_t ParseLine(uint32_t lineno,uint32_t argc,const char **argv) =0;  // return TRUE to continue parsing, return FALSE to abort parsing process
-};
+	MappedFile(const char *fname);
+	~MappedFile(void);
 
-enum SeparatorType
-{
-	ST_DATA,        // is data
-	ST_HARD,        // is a hard separator
-	ST_SOFT,        // is a soft separator
-	ST_EOS          // is a comment symbol, and everything past this character should be ignored
+	const char	*mData;
+	size_t		mLen;
+private:
+#ifdef _WIN32
+	HANDLE		mFile;
+	HANDLE		mMapping;
+#endif
 };
 
-class InPlaceParser
-{
-public:
-	InPlaceParser(void)
-	{
-		Init();
-	}
+#ifdef _WIN32
 
-	InPlaceParser(char *data,uint32_t len)
+MappedFile::MappedFile(const char *fname) : mData(0), mLen(0), mFile(INVALID_HANDLE_VALUE), mMapping(0)
+{
+	mFile = CreateFileA(fname,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+	if ( mFile == INVALID_HANDLE_VALUE )
 	{
-		Init();
-		SetSourceData(data,len);
+		return;
 	}
-
-	InPlaceParser(const char *fname)
+	LARGE_INTEGER size;
+	if ( !GetFileSizeEx(mFile,&size) || size.QuadPart == 0 )
 	{
-		Init();
-		SetFile(fname);
+		return;
 	}
-
-	~InPlaceParser(void);
-
-	void Init(void)
+	mMapping = CreateFileMappingA(mFile,NULL,PAGE_READONLY,0,0,NULL);
+	if ( mMapping )
 	{
-		mQuoteChar = 34;
-		mData = 0;
-		mLen  = 0;
-		mMyAlloc = false;
-		for (uint32_t i=0; i<256; i++)
+		mData = (const char *)MapViewOfFile(mMapping,FILE_MAP_READ,0,0,0);
+		if ( mData )
 		{
-			mHard[i] = ST_DATA;
-			mHardString[i*2] = (char)i;
-			mHardString[i*2+1] = 0;
+			mLen = (size_t)size.QuadPart;
 		}
-		mHard[0]  = ST_EOS;
-		mHard[32] = ST_SOFT;
-		mHard[9]  = ST_SOFT;
-		mHard[13] = ST_SOFT;
-		mHard[10] = ST_SOFT;
-	}
-
-	void SetFile(const char *fname); // use this file as source data to parse.
-
-	void SetSourceData(char *data,uint32_t len)
-	{
-		mData = data;
-		mLen  = len;
-		mMyAlloc = false;
-	};
-
-	uint32_t  Parse(InPlaceParserInterface *callback); // returns true if entire file was parsed, false if it aborted for some reason
-
-	uint32_t ProcessLine(uint32_t lineno,char *line,InPlaceParserInterface *callback);
-
-	const char ** GetArglist(char *source,uint32_t &count); // convert source string into an arg list, this is a destructive parse.
-
-	void SetHardSeparator(char c) // add a hard separator
-	{
-		mHard[c] = ST_HARD;
-	}
-
-	void SetHard(char c) // add a hard separator
-	{
-		mHard[c] = ST_HARD;
 	}
+}
 
-
-	void SetCommentSymbol(char c) // comment character, treated as 'end of string'
+MappedFile::~MappedFile(void)
+{
+	if ( mData )
 	{
-		mHard[c] = ST_EOS;
+		UnmapViewOfFile(mData);
 	}
-
-	void ClearHardSeparator(char c)
+	if ( mMapping )
 	{
-		mHard[c] = ST_DATA;
+		CloseHandle(mMapping);
 	}
-
-
-	void DefaultSymbols(void); // set up default symbols for hard seperator and comment symbol of the '#' character.
-
-	bool EOS(char c)
+	if ( mFile != INVALID_HANDLE_VALUE )
 	{
-		if ( mHard[c] == ST_EOS )
-		{
-			return true;
-		}
-		return false;
-	}
-
-	void SetQuoteChar(char c)
-	{
-		mQuoteChar = c;
+		CloseHandle(mFile);
 	}
+}
 
-private:
-
-
-	inline char * AddHard(uint32_t &argc,const char **argv,char *foo);
-	inline bool   IsHard(char c);
-	inline char * SkipSpaces(char *foo);
-	inline bool   IsWhiteSpace(char c);
-	inline bool   IsNonSeparator(char c); // non seperator,neither hard nor soft
+#else
 
-	bool   mMyAlloc; // whether or not *I* allocated the buffer and am responsible for deleting it.
-	char  *mData;  // ascii data to parse.
-	uint32_t    mLen;   // length of data
-	SeparatorType  mHard[256];
-	char   mHardString[256*2];
-	char           mQuoteChar;
-};
-
-/*******************************************************************/
-/******************** InParser.cpp  ********************************/
-/*******************************************************************/
-void InPlaceParser::SetFile(const char *fname)
+MappedFile::MappedFile(const char *fname) : mData(0), mLen(0)
 {
-	if ( mMyAlloc )
+	int fd = open(fname,O_RDONLY);
+	if ( fd < 0 )
 	{
-		free(mData);
+		return;
 	}
-	mData = 0;
-	mLen  = 0;
-	mMyAlloc = false;
-
-	FILE *fph = fopen(fname,"rb");
-	if ( fph )
+	struct stat st;
+	if ( fstat(fd,&st) == 0 && st.st_size > 0 )
 	{
-		fseek(fph,0L,SEEK_END);
-		mLen = ftell(fph);
-		fseek(fph,0L,SEEK_SET);
-		if ( mLen )
+		void *data = mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+		if ( data != MAP_FAILED )
 		{
-			mData = (char *) malloc(sizeof(char)*(mLen+1));
-			size_t ok = fread(mData, mLen, 1, fph);
-			if ( !ok )
-			{
-				free(mData);
-				mData = 0;
-			}
-			else
-			{
-				mData[mLen] = 0; // zero byte terminate end of file marker.
-				mMyAlloc = true;
-			}
+			mData = (const char *)data;
+			mLen = (size_t)st.st_size;
 		}
-		fclose(fph);
 	}
-
+	close(fd); // the mapping keeps the file referenced
 }
 
-InPlaceParser::~InPlaceParser(void)
+MappedFile::~MappedFile(void)
 {
-	if ( mMyAlloc )
+	if ( mData )
 	{
-		free(mData);
+		munmap((void *)mData,mLen);
 	}
 }
 
-#define MAXARGS 512
+#endif
 
-bool InPlaceParser::IsHard(char c)
-{
-	return mHard[c] == ST_HARD;
-}
+/*******************************************************************/
+/******************** Number parsing  ******************************/
+/*******************************************************************/
 
-char * InPlaceParser::AddHard(uint32_t &argc,const char **argv,char *foo)
+static inline bool isDigit(char c)
 {
-	while ( IsHard(*foo) )
-	{
-		const char *hard = &mHardString[*foo*2];
-		if ( argc < MAXARGS )
-		{
-			argv[argc++] = hard;
-		}
-		foo++;
-	}
-	return foo;
+	return c >= '0' && c <= '9';
 }
 
-bool   InPlaceParser::IsWhiteSpace(char c)
+static inline bool isSpace(char c)
 {
-	return mHard[c] == ST_SOFT;
+	return c == ' ' || c == '\t';
 }
 
-char * InPlaceParser::SkipSpaces(char *foo)
+static inline bool isEndOfLine(char c)
 {
-	while ( !EOS(*foo) && IsWhiteSpace(*foo) ) foo++;
-	return foo;
+	return c == 10 || c == 13;
 }
 
-bool InPlaceParser::IsNonSeparator(char c)
+// Slow path of parseFloat, for everything which is not a plain decimal number.
+static double parseFloatSlow(const char *p,const char *end)
 {
-	if ( !IsHard(c) && !IsWhiteSpace(c) && c != 0 ) return true;
-	return false;
+	char buffer[64];
+	size_t len = (size_t)(end - p);
+	if ( len < sizeof(buffer) )
+	{
+		memcpy(buffer,p,len);
+		buffer[len] = 0;
+		return atof(buffer);
+	}
+	std::string str(p,len);
+	return atof(str.c_str());
 }
 
-
-uint32_t InPlaceParser::ProcessLine(uint32_t lineno,char *line,InPlaceParserInterface *callback)
+// Converts the number at the start of the token [p,end) the way atof does. A decimal mantissa of at
+// most 15 significant digits scaled by at most 10^22 is an exact double operand, so one multiplication
+// or division gives the correctly rounded result; any other number is handed to atof.
+static float parseFloat(const char *p,const char *end)
 {
-	uint32_t ret = 0;
-
-	const char *argv[MAXARGS];
-	uint32_t argc = 0;
-
-	char *foo = line;
-
-	while ( !EOS(*foo) && argc < MAXARGS )
+	static const double powersOf10[] =
 	{
+		1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,
+		1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,1e22
+	};
 
-		foo = SkipSpaces(foo); // skip any leading spaces
-
-		if ( EOS(*foo) ) break;
-
-		if ( *foo == mQuoteChar ) // if it is an open quote
+	const char *s = p;
+	bool negative = false;
+	if ( s < end && (*s == '-' || *s == '+') )
+	{
+		negative = *s == '-';
+		s++;
+	}
+	uint64_t mantissa = 0;
+	int32_t digits = 0; // significant digits in the mantissa
+	int32_t exponent = 0;
+	bool haveDigits = false;
+	while ( s < end && isDigit(*s) )
+	{
+		mantissa = mantissa*10 + (uint64_t)(*s - '0');
+		if ( mantissa ) digits++;
+		haveDigits = true;
+		s++;
+		if ( digits > 15 ) return (float)parseFloatSlow(p,end);
+	}
+	if ( s < end && *s == '.' )
+	{
+		s++;
+		while ( s < end && isDigit(*s) )
 		{
-			foo++;
-			if ( argc < MAXARGS )
-			{
-				argv[argc++] = foo;
-			}
-			while ( !EOS(*foo) && *foo != mQuoteChar ) foo++;
-			if ( !EOS(*foo) )
-			{
-				*foo = 0; // replace close quote with zero byte EOS
-				foo++;
-			}
+			mantissa = mantissa*10 + (uint64_t)(*s - '0');
+			if ( mantissa ) digits++;
+			exponent--;
+			haveDigits = true;
+			s++;
+			if ( digits > 15 ) return (float)parseFloatSlow(p,end);
 		}
-		else
+	}
+	if ( !haveDigits )
+	{
+		return (float)parseFloatSlow(p,end); // inf, nan, or no number at all
+	}
+	if ( s < end && (*s == 'e' || *s == 'E') )
+	{
+		const char *e = s + 1;
+		bool negativeExponent = false;
+		if ( e < end && (*e == '-' || *e == '+') )
 		{
-
-			foo = AddHard(argc,argv,foo); // add any hard separators, skip any spaces
-
-			if ( IsNonSeparator(*foo) )  // add non-hard argument.
+			negativeExponent = *e == '-';
+			e++;
+		}
+		if ( e < end && isDigit(*e) )
+		{
+			int32_t value = 0;
+			while ( e < end && isDigit(*e) )
 			{
-				bool quote  = false;
-				if ( *foo == mQuoteChar )
-				{
-					foo++;
-					quote = true;
-				}
-
-				if ( argc < MAXARGS )
-				{
-					argv[argc++] = foo;
-				}
-
-				if ( quote )
-				{
-					while (*foo && *foo != mQuoteChar ) foo++;
-					if ( *foo ) *foo = 32;
-				}
-
-				// continue..until we hit an eos ..
-				while ( !EOS(*foo) ) // until we hit EOS
-				{
-					if ( IsWhiteSpace(*foo) ) // if we hit a space, stomp a zero byte, and exit
-					{
-						*foo = 0;
-						foo++;
-						break;
-					}
-					else if ( IsHard(*foo) ) // if we hit a hard separator, stomp a zero byte and store the hard separator argument
-					{
-						const char *hard = &mHardString[*foo*2];
-						*foo = 0;
-						if ( argc < MAXARGS )
-						{
-							argv[argc++] = hard;
-						}
-						foo++;
-						break;
-					}
-					foo++;
-				} // end of while loop...
+				if ( value < 10000 ) value = value*10 + (*e - '0');
+				e++;
 			}
+			exponent += negativeExponent ? -value : value;
+			s = e;
 		}
 	}
-
-	if ( argc )
+	if ( s < end && ((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z')) )
 	{
-		ret = callback->ParseLine(lineno, argc, argv );
+		return (float)parseFloatSlow(p,end); // hexadecimal
 	}
-
-	return ret;
+	double value = (double)mantissa;
+	if ( mantissa && exponent )
+	{
+		if ( exponent < -22 || exponent > 22 )
+		{
+			return (float)parseFloatSlow(p,end);
+		}
+		value = exponent < 0 ? value / powersOf10[-exponent] : value * powersOf10[exponent];
+	}
+	return (float)(negative ? -value : value);
 }
 
-uint32_t  InPlaceParser::Parse(InPlaceParserInterface *callback) // returns true if entire file was parsed, false if it aborted for some reason
+// Converts the integer at the start of the token [p,end) the way atoi does; "12/5/7" gives 12.
+static int32_t parseInt(const char *p,const char *end)
 {
-	assert( callback );
-	if ( !mData ) return 0;
-
-	uint32_t ret = 0;
-
-	uint32_t lineno = 0;
-
-	char *foo   = mData;
-	char *begin = foo;
-
-
-	while ( *foo )
+	bool negative = false;
+	if ( p < end && (*p == '-' || *p == '+') )
 	{
-		if ( *foo == 10 || *foo == 13 )
-		{
-			lineno++;
-			*foo = 0;
-
-			if ( *begin ) // if there is any data to parse at all...
-			{
-				uint32_t v = ProcessLine(lineno,begin,callback);
-				if ( v ) ret = v;
-			}
-
-			foo++;
-			if ( *foo == 10 ) foo++; // skip line feed, if it is in the carraige-return line-feed format...
-			begin = foo;
-		}
-		else
-		{
-			foo++;
-		}
+		negative = *p == '-';
+		p++;
 	}
+	uint32_t value = 0;
+	while ( p < end && isDigit(*p) )
+	{
+		value = value*10 + (uint32_t)(*p - '0');
+		p++;
+	}
+	return negative ? -(int32_t)value : (int32_t)value;
+}
 
-	lineno++; // lasst line.
+/*******************************************************************/
+/******************** ObjChunk  ************************************/
+/*******************************************************************/
 
-	uint32_t v = ProcessLine(lineno,begin,callback);
-	if ( v ) ret = v;
-	return ret;
-}
+#define MAXARGS 512
 
+// Parses the 'v' and 'f' lines of a run of whole lines of an obj file. Face indices are absolute, so
+// the chunks of a file can be parsed independently and their results concatenated. Without output
+// arrays a pass only counts the coordinates and indices of the chunk; with them it writes them.
+class ObjChunk
+{
+public:
+	ObjChunk(void)
+	{
+		mVerts = 0;
+		mTriIndices = 0;
+		mVertCount = 0;
+		mIndexCount = 0;
+	}
+	void		Parse(const char *begin,const char *end);
+	void		ParseLine(const char *line,const char *eol);
+	float		*mVerts;
+	uint32_t	*mTriIndices;
+	size_t		mVertCount;		// floats, 3 per vertex
+	size_t		mIndexCount;	// indices, 3 per triangle
+};
 
-void InPlaceParser::DefaultSymbols(void)
+void ObjChunk::Parse(const char *begin,const char *end)
 {
-	SetHardSeparator(',');
-	SetHardSeparator('(');
-	SetHardSeparator(')');
-	SetHardSeparator('=');
-	SetHardSeparator('[');
-	SetHardSeparator(']');
-	SetHardSeparator('{');
-	SetHardSeparator('}');
-	SetCommentSymbol('#');
+	const char *line = begin;
+	while ( line < end )
+	{
+		const char *eol = line;
+		while ( eol < end && !isEndOfLine(*eol) ) eol++;
+		ParseLine(line,eol);
+		line = eol + 1;
+	}
 }
 
-
-const char ** InPlaceParser::GetArglist(char *line,uint32_t &count) // convert source string into an arg list, this is a destructive parse.
+void ObjChunk::ParseLine(const char *line,const char *eol)
 {
-	const char **ret = 0;
-
-	static const char *argv[MAXARGS];
+	// split the line into white space separated arguments
+	const char *argv[MAXARGS];
+	const char *argend[MAXARGS];
 	uint32_t argc = 0;
-
-	char *foo = line;
-
-	while ( !EOS(*foo) && argc < MAXARGS )
+	const char *foo = line;
+	while ( argc < MAXARGS )
 	{
-
-		foo = SkipSpaces(foo); // skip any leading spaces
-
-		if ( EOS(*foo) ) break;
-
-		if ( *foo == mQuoteChar ) // if it is an open quote
+		while ( foo < eol && isSpace(*foo) ) foo++;
+		if ( foo == eol || *foo == 0 ) break;
+		argv[argc] = foo;
+		while ( foo < eol && !isSpace(*foo) && *foo ) foo++;
+		argend[argc++] = foo;
+		if ( argc == 1 && (argend[0] - argv[0] != 1 || (*argv[0] != 'v' && *argv[0] != 'V' && *argv[0] != 'f' && *argv[0] != 'F')) )
 		{
-			foo++;
-			if ( argc < MAXARGS )
-			{
-				argv[argc++] = foo;
-			}
-			while ( !EOS(*foo) && *foo != mQuoteChar ) foo++;
-			if ( !EOS(*foo) )
-			{
-				*foo = 0; // replace close quote with zero byte EOS
-				foo++;
-			}
-		}
-		else
-		{
-
-			foo = AddHard(argc,argv,foo); // add any hard separators, skip any spaces
-
-			if ( IsNonSeparator(*foo) )  // add non-hard argument.
-			{
-				bool quote  = false;
-				if ( *foo == mQuoteChar )
-				{
-					foo++;
-					quote = true;
-				}
-
-				if ( argc < MAXARGS )
-				{
-					argv[argc++] = foo;
-				}
-
-				if ( quote )
-				{
-					while (*foo && *foo != mQuoteChar ) foo++;
-					if ( *foo ) *foo = 32;
-				}
-
-				// continue..until we hit an eos ..
-				while ( !EOS(*foo) ) // until we hit EOS
-				{
-					if ( IsWhiteSpace(*foo) ) // if we hit a space, stomp a zero byte, and exit
-					{
-						*foo = 0;
-						foo++;
-						break;
-					}
-					else if ( IsHard(*foo) ) // if we hit a hard separator, stomp a zero byte and store the hard separator argument
-					{
-						const char *hard = &mHardString[*foo*2];
-						*foo = 0;
-						if ( argc < MAXARGS )
-						{
-							argv[argc++] = hard;
-						}
-						foo++;
-						break;
-					}
-					foo++;
-				} // end of while loop...
-			}
+			return; // neither a vertex nor a face
 		}
 	}
 
-	count = argc;
-	if ( argc )
+	if ( argc == 4 && (*argv[0] == 'v' || *argv[0] == 'V') )
 	{
-		ret = argv;
+		if ( mVerts )
+		{
+			float *v = &mVerts[mVertCount];
+			v[0] = parseFloat(argv[1],argend[1]);
+			v[1] = parseFloat(argv[2],argend[2]);
+			v[2] = parseFloat(argv[3],argend[3]);
+		}
+		mVertCount+=3;
 	}
+	else if ( argc >= 4 && (*argv[0] == 'f' || *argv[0] == 'F') )
+	{
+		uint32_t vcount = argc-1;
+		if ( !mTriIndices )
+		{
+			mIndexCount+=(vcount-2)*3;
+			return;
+		}
 
-	return ret;
-}
-
-/*******************************************************************/
-/******************** Obj.h  ********************************/
-/*******************************************************************/
-
+		uint32_t i1 = (uint32_t)parseInt(argv[1],argend[1])-1;
+		uint32_t i2 = (uint32_t)parseInt(argv[2],argend[2])-1;
+		uint32_t i3 = (uint32_t)parseInt(argv[3],argend[3])-1;
 
-class OBJ : public InPlaceParserInterface
-{
-public:
-	uint32_t	LoadMesh(const char *fname);
-	uint32_t	LoadMesh(const uint8_t *data,uint32_t dlen);
-	uint32_t	ParseLine(uint32_t lineno,uint32_t argc,const char **argv);  // return TRUE to continue parsing, return FALSE to abort parsing process
-	IntVector		mTriIndices;
-	FloatVector		mVerts;
-};
+		uint32_t *t = &mTriIndices[mIndexCount];
+		t[0] = i3;
+		t[1] = i2;
+		t[2] = i1;
+		t+=3;
 
+		for (uint32_t i=2; i<(vcount-1); i++) // do the fan
+		{
+			i2 = i3;
+			i3 = (uint32_t)parseInt(argv[i+2],argend[i+2])-1;
+			t[0] = i3;
+			t[1] = i2;
+			t[2] = i1;
+			t+=3;
+		}
+		mIndexCount+=(vcount-2)*3;
+	}
+}
 
 /*******************************************************************/
-/******************** Obj.cpp  ********************************/
+/******************** OBJ  *****************************************/
 /*******************************************************************/
 
-uint32_t OBJ::LoadMesh(const char *fname)
+// Runs fn(0) .. fn(count-1), each on its own thread.
+template <class Fn> static void parallelFor(uint32_t count,Fn fn)
 {
-	uint32_t ret = 0;
-
-	mVerts.clear();
-	mTriIndices.clear();
-
-	InPlaceParser ipp(fname);
-
-	ipp.Parse(this);
-
-
-	return ret;
+	std::vector< std::thread > threads;
+	for (uint32_t i=1; i<count; i++)
+	{
+		threads.push_back(std::thread(fn,i));
+	}
+	fn(0);
+	for (size_t i=0; i<threads.size(); i++)
+	{
+		threads[i].join();
+	}
 }
 
-uint32_t OBJ::LoadMesh(const uint8_t *data,uint32_t dlen)
+// Splits an obj file into chunks of whole lines, one per hardware thread. A first concurrent pass counts
+// the vertices and triangles of each chunk, a second one parses each chunk at its offset in the arrays
+// handed over to WavefrontObj.
+class OBJ
 {
-	uint32_t ret = 0;
-
-	mVerts.clear();
-	mTriIndices.clear();
-
-	uint8_t *tdata = new uint8_t[dlen+1];
-	tdata[dlen] = 0;
-	memcpy(tdata,data,dlen);
-	InPlaceParser ipp((char *)tdata,dlen);
-	ipp.Parse(this);
-	delete []tdata;
-
+public:
+	void		LoadMesh(const char *data,size_t len);
 
-	return ret;
-}
+	uint32_t	mVertexCount;
+	uint32_t	mTriCount;
+	float		*mVertices;
+	uint32_t	*mIndices;
+};
 
-uint32_t OBJ::ParseLine(uint32_t /*lineno*/,uint32_t argc,const char **argv)  // return TRUE to continue parsing, return FALSE to abort parsing process
+void OBJ::LoadMesh(const char *data,size_t len)
 {
-  uint32_t ret = 0;
-
-  if ( argc >= 1 )
-  {
-    const char *foo = argv[0];
-    if ( *foo != '#' )
-    {
-      if ( strcasecmp(argv[0],"v") == 0 && argc == 4 )
-      {
-        float vx = (float) atof( argv[1] );
-        float vy = (float) atof( argv[2] );
-        float vz = (float) atof( argv[3] );
-        mVerts.push_back(vx);
-        mVerts.push_back(vy);
-        mVerts.push_back(vz);
-      }
-      else if ( strcasecmp(argv[0],"f") == 0 && argc >= 4 )
-      {
-
-
-        uint32_t vcount = argc-1;
-
-		uint32_t i1 = (uint32_t)atoi(argv[1])-1;
-		uint32_t i2 = (uint32_t)atoi(argv[2])-1;
-		uint32_t i3 = (uint32_t)atoi(argv[3])-1;
-
-		mTriIndices.push_back(i3);
-		mTriIndices.push_back(i2);
-		mTriIndices.push_back(i1);
-
-
-        if ( vcount >=3 ) // do the fan
-        {
-          for (uint32_t i=2; i<(vcount-1); i++)
-          {
-			  i2 = i3;
-			  i3 = (uint32_t)atoi(argv[i+2])-1;
-			  mTriIndices.push_back(i3);
-			  mTriIndices.push_back(i2);
-			  mTriIndices.push_back(i1);
-          }
-        }
-      }
-    }
-  }
-
-  return ret;
-}
-
+	const size_t minChunkSize = 1 << 20;
+	uint32_t chunkCount = std::thread::hardware_concurrency();
+	if ( chunkCount == 0 ) chunkCount = 1;
+	if ( len / minChunkSize < chunkCount ) chunkCount = (uint32_t)(len / minChunkSize) + 1;
+
+	// chunk boundaries are moved forward to the start of the next line
+	std::vector< size_t > bounds(chunkCount+1);
+	bounds[0] = 0;
+	bounds[chunkCount] = len;
+	for (uint32_t i=1; i<chunkCount; i++)
+	{
+		size_t b = len / chunkCount * i;
+		if ( b < bounds[i-1] ) b = bounds[i-1];
+		while ( b < len && !isEndOfLine(data[b]) ) b++;
+		bounds[i] = b < len ? b + 1 : len;
+	}
 
+	std::vector< ObjChunk > chunks(chunkCount);
+	parallelFor(chunkCount,[&](uint32_t i)
+	{
+		chunks[i].Parse(data + bounds[i],data + bounds[i+1]);
+	});
 
+	size_t vertexOffset = 0;
+	size_t indexOffset = 0;
+	for (uint32_t i=0; i<chunkCount; i++)
+	{
+		const size_t vertCount = chunks[i].mVertCount;
+		const size_t indexCount = chunks[i].mIndexCount;
+		chunks[i].mVertCount = vertexOffset;
+		chunks[i].mIndexCount = indexOffset;
+		vertexOffset+=vertCount;
+		indexOffset+=indexCount;
+	}
+	mVertexCount = (uint32_t)(vertexOffset/3);
+	mTriCount = (uint32_t)(indexOffset/3);
+	mVertices = mVertexCount ? new float[mVertexCount*3] : 0;
+	mIndices = mTriCount ? new uint32_t[mTriCount*3] : 0;
+	if ( !mVertices && !mIndices )
+	{
+		return;
+	}
 
+	// the counts left by the first pass now hold the offsets of the chunks in the arrays
+	parallelFor(chunkCount,[&](uint32_t i)
+	{
+		ObjChunk &c = chunks[i];
+		c.mVerts = mVertices;
+		c.mTriIndices = mIndices;
+		c.Parse(data + bounds[i],data + bounds[i+1]);
+	});
+}
 
 };
 
@@ -636,30 +508,17 @@ WavefrontObj::~WavefrontObj(void)
 
 uint32_t WavefrontObj::loadObj(const uint8_t *data,uint32_t dlen)
 {
-	uint32_t ret = 0;
-
+	releaseMesh();
 
 	OBJ obj;
+	obj.LoadMesh((const char *)data,dlen);
 
-	obj.LoadMesh(data,dlen);
-
-	mVertexCount = (uint32_t)obj.mVerts.size()/3;
-	mTriCount = (uint32_t)obj.mTriIndices.size()/3;
-
-	if ( mVertexCount )
-	{
-		mVertices = new float[mVertexCount*3];
-		memcpy(mVertices, &obj.mVerts[0], sizeof(float)*mVertexCount*3);
-	}
-
-	if ( mTriCount )
-	{
-		mIndices = new uint32_t[mTriCount*3];
-		memcpy(mIndices,&obj.mTriIndices[0],mTriCount*3*sizeof(uint32_t));
-	}
-	ret = mTriCount;
+	mVertexCount = obj.mVertexCount;
+	mTriCount = obj.mTriCount;
+	mVertices = obj.mVertices;
+	mIndices = obj.mIndices;
 
-	return ret;
+	return mTriCount;
 }
 
 void WavefrontObj::releaseMesh(void)
@@ -674,31 +533,21 @@ void WavefrontObj::releaseMesh(void)
 
 uint32_t WavefrontObj::loadObj(const char *fname) // load a wavefront obj returns number of triangles that were loaded.  Data is persists until the class is destructed.
 {
+	releaseMesh();
 
-	uint32_t ret = 0;
-
-
-	OBJ obj;
-
-	obj.LoadMesh(fname);
-
-	mVertexCount = (uint32_t)obj.mVerts.size()/3;
-	mTriCount = (uint32_t)obj.mTriIndices.size()/3;
-
-	if ( mVertexCount )
+	MappedFile file(fname);
+	if ( file.mData )
 	{
-		mVertices = new float[mVertexCount*3];
-		memcpy(mVertices, &obj.mVerts[0], sizeof(float)*mVertexCount*3);
-	}
+		OBJ obj;
+		obj.LoadMesh(file.mData,file.mLen);
 
-	if ( mTriCount )
-	{
-		mIndices = new uint32_t[mTriCount*3];
-		memcpy(mIndices,&obj.mTriIndices[0],mTriCount*3*sizeof(uint32_t));
+		mVertexCount = obj.mVertexCount;
+		mTriCount = obj.mTriCount;
+		mVertices = obj.mVertices;
+		mIndices = obj.mIndices;
 	}
-	ret = mTriCount;
 
-	return ret;
+	return mTriCount;
 }
 
 